@@ -3,6 +3,7 @@
 
 #include <limits>
 #include <vector>
+#include <memory>
 
 #include "G4ThreeVector.hh"
 
@@ -26,14 +27,17 @@ class centerOfMass{
   public:
 	/** Default constructor
 	  */
-	centerOfMass() : Ncol(-1), Nrow(-1), Npts(0), NnotDetected(0), totalMass(0), t0(std::numeric_limits<double>::max()), tSum(0), lambdaSum(0),
-	                 activeWidth(0), activeHeight(0), pixelWidth(0), pixelHeight(0), center(0, 0, 0), response() { }
+	centerOfMass() : Ncol(-1), Nrow(-1), Npts(0), NnotDetected(0), totalMass(0), totalWeight(0), t0(std::numeric_limits<double>::max()), tSum(0), lambdaSum(0),
+	                 activeWidth(0), activeHeight(0), pixelWidth(0), pixelHeight(0), center(0, 0, 0), response() { 
+		for(size_t i = 0; i < 4; i++) anodeCurrent[i] = 0;
+	}
 
 	/** Destructor
 	  */
 	~centerOfMass();
 
-	/** Clone this object
+	/** Clone the configuration of this object
+	  * @note The anode gain matrix and the immutable tables of the PMT responses are shared with the clone
 	  */
 	centerOfMass clone() const ;
 
@@ -99,6 +103,11 @@ class centerOfMass{
 	  */
 	size_t getNumDetected() const { return Npts; }
 
+	/** Get the sum of the weights of all detected photons
+	  * @note This is equal to the total number of detected photons unless optical photons have been given statistical weights
+	  */
+	double getWeightedNumDetected() const { return totalWeight; }
+
 	/** Get the number of photons not detected
 	  */
 	size_t getNumNotDetected() const { return NnotDetected; }
@@ -134,6 +143,14 @@ class centerOfMass{
 	/** Get a const pointer to the array containing the four Anger Logic output responses
 	  */
 	const pmtResponse *getConstAnodeResponse() const { return (const pmtResponse*)anodeResponse; }
+
+	/** Get the buffer of all photons detected by the PMT during this event
+	  */
+	const photonHitBuffer *getHitBuffer() const { return &hits; }
+
+	/** Return true if the four Anger Logic anode readouts are enabled (segmented PMT) and return false otherwise
+	  */
+	bool hasAnodeReadout() const { return (bool)anodeFractions; }
 	
 	/** Get the four Anger Logic currents {V1, V2, V3, V4}
 	  * @param array Array of at least 4 doubles
@@ -150,7 +167,7 @@ class centerOfMass{
 	
 	/** Get the anode gain matrix
 	  */
-	void getGainMatrix(std::vector<std::vector<double> > &matrix) const { matrix = gainMatrix; }
+	void getGainMatrix(std::vector<std::vector<double> > &matrix) const ;
 	
 	/** Get the anode hit count matrix
 	  */
@@ -197,23 +214,13 @@ class centerOfMass{
 	  */	
 	bool loadGainMatrix(const char *fname);
 
-	/** Copy the anode quantum efficiency spectrum from another centerOfMass object
-	  * @param other Pointer to a centerOfMass object from which to copy the anode quantum efficiency spectrum
-	  */
-	void copySpectralResponse(centerOfMass *other);
-
-	/** Copy the anode quantum efficiency spectrum from another centerOfMass object
-	  * @param other Pointer to a centerOfMass object from which to copy the anode quantum efficiency spectrum
+	/** Share the anode quantum efficiency spectrum of another centerOfMass object
+	  * @param other Pointer to a centerOfMass object whose anode quantum efficiency spectrum will be used
 	  */	
 	void copySpectralResponse(const centerOfMass *other);
 
-	/** Copy the anode gain matrix from another centerOfMass object
-	  * @param other Pointer to a centerOfMass object from which to copy the matrix of anode gain percentages
-	  */	
-	void copyGainMatrix(centerOfMass *other);
-
-	/** Copy the anode gain matrix from another centerOfMass object
-	  * @param other Pointer to a centerOfMass object from which to copy the matrix of anode gain percentages
+	/** Share the anode gain matrix of another centerOfMass object
+	  * @param other Pointer to a centerOfMass object whose matrix of anode gain percentages will be used
 	  */	
 	void copyGainMatrix(const centerOfMass *other);
 	
@@ -221,6 +228,11 @@ class centerOfMass{
 	  */
 	void clear();
 
+	/** Digitize the light pulse of the dynode and, for a segmented PMT, the four Anger Logic anode readouts
+	  * @note All readouts are built from the same photon hit buffer in a single pass. The anode readouts use the ADC latching time of the dynode
+	  */
+	void digitize();
+
 	/** Add a photon to the center-of-mass distribution
 	  * @param energy Energy of the photon (in MeV)
 	  * @param time Time-of-arrival of the photon (in ns)
@@ -246,6 +258,7 @@ class centerOfMass{
 	size_t NnotDetected; ///< Number of photons not detected by the sensitive surface
 	
 	double totalMass; ///< Total photon weight for the weighted average
+	double totalWeight; ///< Sum of the weights of all detected photons
 	double t0; ///< Photon minimum time-of-arrival
 	double tSum; ///< Sum of all photon arrival times
 	double lambdaSum; ///< Sum of all photon wavelengths
@@ -262,9 +275,13 @@ class centerOfMass{
 	
 	pmtResponse response; ///< Light pulse response of the dynode
 	
-	pmtResponse anodeResponse[4]; // Light pulse response of the four Anger Logic readouts
+	pmtResponse anodeResponse[4]; ///< Light pulse response of the four Anger Logic readouts
+
+	photonHitBuffer hits; ///< All photons detected by the PMT during this event. Shared by the dynode and the anode readouts
+
+	std::shared_ptr<const std::vector<double> > anodeFractions; ///< Fraction of the current of each anode which flows to each of the four Anger Logic readouts (immutable and shared by all copies of this object)
 	
-	std::vector<std::vector<double> > gainMatrix; ///< Matrix containing the gain of each PSPMT anode (in percent)
+	std::shared_ptr<const std::vector<std::vector<double> > > gainMatrix; ///< Matrix containing the gain of each PSPMT anode, in percent (immutable and shared by all copies of this object)
 	std::vector<std::vector<int> > countMatrix; ///< Matrix containing the number of photon counts of each PSPMT anode
 	
 	/** Increment the anode hit count matrix at position (x, y)
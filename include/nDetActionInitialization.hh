@@ -5,9 +5,9 @@
 
 class nDetRunAction;
 class nDetEventAction;
-class nDetSteppingAction;
 class nDetStackingAction;
 class nDetTrackingAction;
+class nDetSteppingAction;
 
 class nDetActionInitialization;
 
@@ -37,10 +37,6 @@ class userActionManager{
 	  */	
 	nDetEventAction* getEventAction(){ return eventAction; }
 
-	/** Get a pointer to the stepping action for this thread
-	  */	
-	nDetSteppingAction* getSteppingAction(){ return steppingAction; }
-
 	/** Get a pointer to the stacking action for this thread
 	  */	
 	nDetStackingAction* getStackingAction(){ return stackingAction; }
@@ -49,6 +45,10 @@ class userActionManager{
 	  */	
 	nDetTrackingAction* getTrackingAction(){ return trackingAction; }	
 
+	/** Get a pointer to the stepping action for this thread
+	  */	
+	nDetSteppingAction* getSteppingAction(){ return steppingAction; }
+
 	/** Get a pointer to the action initialization for this thread
 	  */
 	const nDetActionInitialization* getActionInit(){ return actionInit; }
@@ -58,9 +58,9 @@ class userActionManager{
 	
 	nDetRunAction* runAction; ///< Pointer to the run action for this thread
 	nDetEventAction* eventAction; ///< Pointer to the event action for this thread
-	nDetSteppingAction* steppingAction; ///< Pointer to the stepping action for this thread
 	nDetStackingAction* stackingAction; ///< Pointer to the stacking action for this thread
 	nDetTrackingAction* trackingAction; ///< Pointer to the tracking action for this thread
+	nDetSteppingAction* steppingAction; ///< Pointer to the stepping action for this thread
 	
 	const nDetActionInitialization* actionInit; ///< Pointer to the action initialization
 };
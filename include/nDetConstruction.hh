@@ -5,19 +5,23 @@
 
 #include "G4VUserDetectorConstruction.hh"
 #include "G4RotationMatrix.hh"
+#include "G4VPhysicalVolume.hh"
 #include "globals.hh"
 
 #include "centerOfMass.hh"
 #include "nDetDetector.hh"
 #include "nDetDetectorTypes.hh"
 #include "nDetMaterials.hh"
+#include "nDetLightMap.hh"
 
 // Class declarations
 class nDetConstructionMessenger;
 class nDetWorld;
 
 class G4Material;
-class G4VPhysicalVolume;
+class G4VSolid;
+class G4Region;
+class G4VUserPhysicsList;
 
 /** @class nDetConstruction
   * @brief Handles construction of NEXTSim detector setups
@@ -27,6 +31,18 @@ class G4VPhysicalVolume;
 
 class nDetConstruction : public G4VUserDetectorConstruction{
   public:
+	/** Roles of physical volumes used to classify particle steps
+	  */
+	enum volumeRole {UNCLASSIFIED, WORLD, ASSEMBLY, SCINTILLATOR, SENSITIVE};
+
+	/** Optical photon quantum efficiency pre-culling modes
+	  */
+	enum qeCullingMode {QE_CULL_OFF, QE_CULL_MAXIMUM, QE_CULL_WAVELENGTH};
+
+	/** Modes used to kill non-optical particles which leave the detectors
+	  */
+	enum particleKillMode {KILL_OFF, KILL_ENVELOPE, KILL_REGION};
+
 	/** Destructor
 	  */
 	~nDetConstruction();
@@ -54,6 +70,11 @@ class nDetConstruction : public G4VUserDetectorConstruction{
 	  */
 	G4VPhysicalVolume* ConstructDetector();
 
+	/** Attach the thread-local sensitive detectors to all PMT and scintillator logical volumes
+	  * @note Called by Geant for each thread after the geometry has been constructed
+	  */
+	virtual void ConstructSDandField();
+
 	/** Add a detector geometry to the list of detectors
 	  * @note See nDetDetector::setGeometry() for accepted geometry names
 	  * @return True if the specified type is recognized and return false otherwise
@@ -164,6 +185,236 @@ class nDetConstruction : public G4VUserDetectorConstruction{
 	/** Get clones of all currently defined detectors
 	  */
 	void GetCopiesOfDetectors(std::vector<nDetDetector> &detectors) const ;
+
+	/** Enable light map building mode. All optical photons will be tracked normally and the resulting
+	  * light maps will be written to a root file at the end of each run
+	  * @param fname Path to the output light map file
+	  */
+	void BuildLightMap(const std::string &fname);
+
+	/** Load light maps for all detectors from a root file and enable fast light map simulation mode
+	  * @param fname Path to the input light map file
+	  * @return True if at least one light map is loaded successfully and return false otherwise
+	  */
+	bool LoadLightMap(const std::string &fname);
+
+	/** Disable light map building and fast simulation modes
+	  */
+	void DisableLightMap(){ lightMapMode = nDetLightMap::OFF; }
+
+	/** Set the number of light map voxels using a space-delimited input string
+	  * @note String syntax: <nx> <ny> <nz>
+	  */
+	void SetLightMapVoxels(const G4String &input);
+
+	/** Set the number of light map arrival time bins using a space-delimited input string
+	  * @note String syntax: <nbins> [tmax=50 ns]
+	  */
+	void SetLightMapTimeBins(const G4String &input);
+
+	/** Set the number of light map hit position bins using a space-delimited input string
+	  * @note String syntax: <nx> [ny=nx]
+	  */
+	void SetLightMapPositionBins(const G4String &input);
+
+	/** Setup the light maps for all defined detectors at the start of a run
+	  * @note In building mode, new maps are created if the detector setup has changed. In fast simulation 
+	  *       mode, the loaded maps are checked against the detector setup and the mode is disabled on mismatch
+	  * @return True if the light maps are ready for use and return false otherwise
+	  */
+	bool InitializeLightMaps();
+
+	/** Write the light maps for all detectors to the output light map file (building mode only)
+	  * @return True if the light maps are written successfully and return false otherwise
+	  */
+	bool WriteLightMaps();
+
+	/** Print information about all light maps
+	  */
+	void PrintLightMaps() const ;
+
+	/** Get the current light map operating mode
+	  */
+	nDetLightMap::mapMode GetLightMapMode() const { return lightMapMode; }
+
+	/** Get a pointer to the light map for a detector
+	  * @param index The ID of the detector
+	  * @return A pointer to the light map if it exists and return NULL otherwise
+	  */
+	nDetLightMap *GetLightMap(const size_t &index){ return (index < lightMaps.size() ? lightMaps.at(index) : NULL); }
+
+	/** Set the survival probability for newly generated optical photons
+	  * @note Optical photons are killed at birth with probability 1-p and surviving photons are given a
+	  *       statistical weight of 1/p, so that all detected photon sums remain unbiased
+	  * @param prob Optical photon survival probability in the range (0, 1]
+	  */
+	void SetPhotonSurvivalProbability(const G4double &prob);
+
+	/** Get the survival probability for newly generated optical photons
+	  */
+	G4double GetPhotonSurvivalProbability() const { return photonSurvivalProb; }
+
+	/** Set the maximum global time of optical photons using an input string
+	  * @note String syntax: <off|auto|time>. In "auto" mode the cut is set to the end of the PMT acquisition window at the start of each run.
+	  *       Otherwise, the cut is set to the specified time (in ns)
+	  */
+	void SetPhotonTimeCut(const G4String &input);
+
+	/** Set the maximum track length of optical photons (in mm). A length of zero disables the cut
+	  */
+	void SetPhotonMaxTrackLength(const G4double &length);
+
+	/** Set the maximum number of optical boundary reflections of optical photons. A count of zero disables the cut
+	  */
+	void SetPhotonMaxReflections(const G4int &count);
+
+	/** Compute the optical photon global time cut at the start of a run
+	  * @note In "auto" mode, the cut is the latest end of the acquisition window of the PMTs of all detectors
+	  * @return True if the time cut is enabled for the run and return false otherwise
+	  */
+	bool InitializePhotonCuts();
+
+	/** Get the maximum global time of optical photons for the current run (in ns). Return zero if the cut is disabled
+	  */
+	G4double GetPhotonMaxTime() const { return photonMaxTime; }
+
+	/** Get the maximum track length of optical photons (in mm). Return zero if the cut is disabled
+	  */
+	G4double GetPhotonMaxTrackLength() const { return photonMaxTrackLength; }
+
+	/** Get the maximum number of optical boundary reflections of optical photons. Return zero if the cut is disabled
+	  */
+	G4int GetPhotonMaxReflections() const { return photonMaxReflections; }
+
+	/** Return true if any of the optical photon cuts are enabled and return false otherwise
+	  */
+	bool GetPhotonCutsEnabled() const { return (photonMaxTime > 0 || photonMaxTrackLength > 0 || photonMaxReflections > 0 || !trackPhotonsOutside); }
+
+	/** Enable or disable deferred tracking of optical photons
+	  * @note When enabled, optical photons are moved to the waiting stack and are only tracked after all other particles
+	  *       have been tracked, and only if the primary particle entered a scintillator and deposited at least the trigger threshold energy
+	  */
+	void SetDeferOpticalPhotons(const G4bool &state){ deferOpticalPhotons = state; }
+
+	/** Set the minimum energy deposited by the primary particle in the scintillators required to track optical photons (in MeV)
+	  * @note Only used when deferred optical photon tracking is enabled
+	  */
+	void SetOpticalTriggerThreshold(const G4double &threshold);
+
+	/** Return true if deferred tracking of optical photons is enabled and return false otherwise
+	  */
+	G4bool GetDeferOpticalPhotons() const { return deferOpticalPhotons; }
+
+	/** Get the minimum energy deposited by the primary particle in the scintillators required to track optical photons (in MeV)
+	  */
+	G4double GetOpticalTriggerThreshold() const { return opticalTriggerThreshold; }
+
+	/** Setup the kill mode for particles leaving the detectors at the start of a run
+	  * @note If automatic killing is enabled in the world, the envelope mode is used when the world contains no scattering material 
+	  *       and the region mode is used otherwise (if a kill region is defined). The envelope of each detector is the solid of its assembly volume
+	  * @return True if particles leaving the detectors will be killed and return false otherwise
+	  */
+	bool InitializeKillMode();
+
+	/** Get the kill mode in use for the current run
+	  */
+	particleKillMode GetKillMode() const { return killMode; }
+
+	/** Check whether or not a particle in the world volume should be killed
+	  * @param position The global position of the particle
+	  * @param direction The momentum direction of the particle
+	  * @return True if the particle can no longer reach any detector (envelope mode) or is outside the kill region (region mode) and return false otherwise
+	  */
+	bool CheckKillParticle(const G4ThreeVector &position, const G4ThreeVector &direction) const ;
+
+	/** Set the optical photon quantum efficiency pre-culling mode
+	  * @note In "max" mode, new optical photons survive with the maximum PMT quantum efficiency and detected photons are
+	  *       accepted with probability QE(lambda)/QEmax. In "wavelength" mode, new optical photons survive with the quantum 
+	  *       efficiency for their wavelength and all detected photons are accepted. Accepted photons are not weighted by the 
+	  *       quantum efficiency a second time, so the PMT response is unchanged on average while far fewer photons are tracked
+	  * @param mode The pre-culling mode ("off", "max", or "wavelength")
+	  */
+	void SetQuantumEfficiencyCulling(const G4String &mode);
+
+	/** Setup quantum efficiency pre-culling at the start of a run
+	  * @note Pre-culling is disabled for the run if any PMT does not have a quantum efficiency spectrum or if light maps are being built.
+	  *       "wavelength" mode falls back to "max" mode if the PMTs do not all share the same spectrum
+	  * @return True if pre-culling is enabled for the run and return false otherwise
+	  */
+	bool InitializeQuantumEfficiencyCulling();
+
+	/** Get the quantum efficiency pre-culling mode in use for the current run
+	  */
+	qeCullingMode GetQuantumEfficiencyCulling() const { return qeCullingActive; }
+
+	/** Get the name of the quantum efficiency pre-culling mode in use for the current run ("off", "max", or "wavelength")
+	  */
+	std::string GetQuantumEfficiencyCullingString() const ;
+
+	/** Get the probability that a new optical photon survives quantum efficiency pre-culling
+	  * @param wavelength Optical photon wavelength (in nm)
+	  */
+	G4double GetQuantumEfficiencySurvivalProbability(const G4double &wavelength) const ;
+
+	/** Set the production cut of one of the detector regions using a space-delimited input string
+	  * @note String syntax: <region> <cut>. Region names are "scint" (scintillators), "detector" (all other detector assembly components),
+	  *       and "world" (floor and world objects). The cut is in mm, a cut of zero uses the default production cut of the world
+	  */
+	void SetProductionCut(const G4String &input);
+
+	/** Print the production cuts of all detector regions
+	  */
+	void PrintProductionCuts() const ;
+
+	/** Enable or disable optical photon transport outside of the detector assemblies
+	  * @note When disabled, optical photons generated outside of the detectors are killed at birth and optical photons entering the world volume are killed
+	  */
+	void SetTrackPhotonsOutsideDetectors(const G4bool &state){ trackPhotonsOutside = state; }
+
+	/** Return true if optical photons are tracked outside of the detector assemblies and return false otherwise
+	  */
+	G4bool GetTrackPhotonsOutsideDetectors() const { return trackPhotonsOutside; }
+
+	/** Return true if a physical volume belongs to one of the detector assemblies (scintillator or detector regions) and return false otherwise
+	  */
+	bool IsInsideDetectors(const G4VPhysicalVolume *physV) const ;
+
+	/** Set the physics list used for the physics table cache
+	  * @param list Pointer to the physics list used by the run manager
+	  * @param name Name of the physics list (used as part of the cache key)
+	  */
+	void SetPhysicsList(G4VUserPhysicsList *list, const std::string &name){ physicsList = list; physicsListName = name; }
+
+	/** Set the directory used to store and retrieve physics tables
+	  * @note Tables are kept in a sub-directory named after a hash of the physics list, the Geant version, all materials, and the production cuts of
+	  *       all regions. Tables are retrieved automatically if a matching sub-directory exists, and are stored at the start of the first run otherwise
+	  * @param dir Path to the cache directory. The cache is disabled if the path is empty or "off"
+	  */
+	void SetPhysicsCacheDirectory(const std::string &dir);
+
+	/** Select physics table retrieval for the current materials and production cuts (if the cache is enabled). Called at the end of ConstructDetector()
+	  * @return True if matching physics tables were found in the cache and return false otherwise
+	  */
+	bool PreparePhysicsCache();
+
+	/** Store the physics tables in the cache if they were not retrieved from it. Must be called from the master thread after the physics tables are built
+	  * @return True if the physics tables were stored and return false otherwise
+	  */
+	bool StorePhysicsCache();
+
+	/** Get the path to the physics table cache sub-directory for the current materials and production cuts (empty if the cache is disabled)
+	  */
+	std::string GetPhysicsCachePath() const { return physicsCachePath; }
+
+	/** Get the role of a physical volume in the current geometry
+	  * @note The classification table is built by ConstructDetector(), so this lookup is a single array access
+	  * @param physV Pointer to a physical volume
+	  * @return The role of the volume or UNCLASSIFIED if the volume has no special role
+	  */
+	volumeRole GetVolumeRole(const G4VPhysicalVolume *physV) const {
+		G4int id = (physV ? physV->GetInstanceID() : -1);
+		return ((id >= 0 && id < (G4int)volumeRoles.size()) ? volumeRoles[id] : UNCLASSIFIED);
+	}
 	
   private:
 	nDetConstructionMessenger *fDetectorMessenger; ///< Geant messenger to use for this class
@@ -185,6 +436,84 @@ class nDetConstruction : public G4VUserDetectorConstruction{
 
 	nDetWorld *expHall; ///< Pointer to the experimental hall setup area
 
+	nDetLightMap::mapMode lightMapMode; ///< Light map operating mode
+	
+	nDetLightMap lightMapBinning; ///< Light map used to store the user binning parameters for new light maps
+
+	std::vector<nDetLightMap*> lightMaps; ///< Vector of light maps for all detectors
+
+	std::string lightMapFilename; ///< Path to the output light map file
+
+	G4double photonSurvivalProb; ///< Survival probability for newly generated optical photons
+
+	bool photonTimeCutAuto; ///< Flag indicating that the optical photon time cut is set from the PMT acquisition window
+	G4double photonTimeCut; ///< Maximum global time of optical photons specified by the user (in ns)
+	G4double photonMaxTime; ///< Maximum global time of optical photons in use for the current run (in ns)
+	G4double photonMaxTrackLength; ///< Maximum track length of optical photons (in mm)
+	G4int photonMaxReflections; ///< Maximum number of boundary reflections of optical photons
+
+	particleKillMode killMode; ///< Kill mode for particles leaving the detectors in use for the current run
+
+	std::vector<const G4VSolid*> envelopeSolids; ///< Solid of the assembly volume of each detector
+	std::vector<G4ThreeVector> envelopePositions; ///< Global position of the assembly volume of each detector
+	std::vector<G4RotationMatrix> envelopeRotations; ///< Rotation of the assembly volume of each detector
+
+	G4ThreeVector killRegionHalfSize; ///< Half-size of the kill region along the X, Y, and Z axes (all in mm)
+
+	G4Region *scintRegion; ///< Region containing all scintillator volumes
+	G4Region *detectorRegion; ///< Region containing all detector assembly volumes other than the scintillators
+	G4Region *worldRegion; ///< Region containing the floor and all objects placed in the world
+
+	G4double scintCut; ///< Production cut of the scintillator region (in mm)
+	G4double detectorCut; ///< Production cut of the detector region (in mm)
+	G4double worldCut; ///< Production cut of the world region (in mm)
+
+	G4bool trackPhotonsOutside; ///< Flag indicating that optical photons are tracked outside of the detector assemblies
+
+	G4VUserPhysicsList *physicsList; ///< Pointer to the physics list used by the run manager
+	std::string physicsListName; ///< Name of the physics list
+	std::string physicsCacheDir; ///< Path to the physics table cache directory (empty if the cache is disabled)
+	std::string physicsCachePath; ///< Path to the cache sub-directory for the current materials and production cuts
+	std::string physicsCacheKey; ///< Description of the physics list, materials, and production cuts for the current geometry
+	G4bool physicsCacheRetrieved; ///< Flag indicating that the physics tables will be retrieved from the cache
+
+	G4bool deferOpticalPhotons; ///< Flag indicating that optical photons are tracked in a second stacking stage
+	G4double opticalTriggerThreshold; ///< Minimum primary particle energy deposition required to track optical photons (in MeV)
+
+	qeCullingMode qeCulling; ///< Optical photon quantum efficiency pre-culling mode selected by the user
+	qeCullingMode qeCullingActive; ///< Optical photon quantum efficiency pre-culling mode in use for the current run
+
+	const spectralResponse *qeCullingSpectrum; ///< Quantum efficiency spectrum shared by all PMTs ("wavelength" mode only)
+	G4double qeCullingMaximum; ///< Maximum quantum efficiency of all PMTs (fraction)
+
+	std::vector<volumeRole> volumeRoles; ///< Role of every physical volume, indexed by volume instance ID
+
+	/** Delete all light maps
+	  */
+	void clearLightMaps();
+
+	/** Build the physical volume classification table for the current geometry
+	  */
+	void classifyVolumes();
+
+	/** Define the scintillator, detector, and world regions for the current geometry and apply their production cuts
+	  */
+	void defineRegions();
+
+	/** Apply a production cut to a region
+	  * @param region Pointer to the region
+	  * @param cut The production cut (in mm). If zero, the region will use the default production cut of the world
+	  */
+	void applyProductionCut(G4Region *region, const G4double &cut);
+
+	/** Get a string describing the physics list, the Geant version, all materials, and the production cuts of all regions
+	  */
+	std::string getPhysicsCacheKey() const ;
+
+	/** Remove a physics table cache directory and all files it contains
+	  */
+	static void removeDirectory(const std::string &path);
+
 	/** Default constructor. Private for singleton class
 	  */
 	nDetConstruction();
@@ -6,6 +6,7 @@
 #include "nDetStructures.hpp"
 
 class TBranch;
+class TTree;
 
 /** @class nDetDataPack
   * @brief Stores simulated data and output variables
@@ -28,6 +29,22 @@ class nDetDataPack{
 
 	void copyData(nDetEventStructure *evt, nDetOutputStructure *out, nDetMultiOutputStructure *mult, nDetDebugStructure *debug, nDetTraceStructure *trace) const ;
 
+	/** Copy all data from another data pack into the structures pointed to by this pack
+	  */
+	void copyData(const nDetDataPack &other);
+
+	/** Add branches to an output tree which read directly from the data structures pointed to by this pack
+	  * 
+	  * The branches are bound to the addresses of the structure pointers, not to the structures themselves. Assigning
+	  * another data pack to this one (a copy of five pointers) will therefore cause the next call to TTree::Fill() to
+	  * read from the structures of the other pack without copying any data
+	  * @param tree Pointer to the output tree
+	  * @param singleDetector Flag indicating that the single-detector output branch will be added (otherwise the multi-detector branch is added)
+	  * @param debug Flag indicating that the debug branch will be added (single-detector mode only)
+	  * @param trace Flag indicating that the trace branch will be added
+	  */
+	void setBranches(TTree *tree, const bool &singleDetector, const bool &debug, const bool &trace);
+
 	/** Return true if the current event is a good detection event, meaning that optical photons
 	  * were detected at the photo-sensitive surfaces of the detector, and return false otherwise
 	  */
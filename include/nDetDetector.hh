@@ -197,6 +197,10 @@ public:
 	  */
 	G4ThreeVector GetDetectorSize() const { return G4ThreeVector(fDetectorWidth, fDetectorHeight, fDetectorLength); }
 
+	/** Get a vector containing the maximum width, height, and length of the detector body (all in mm)
+	  */
+	G4ThreeVector GetMaxBodySize() const { return maxBodySize; }
+
 	/** Get the X position of the center of the detector (in mm)
 	  */
 	G4double GetDetectorPosX() const { return detectorPosition.getX(); }
@@ -378,6 +382,14 @@ public:
 	  */
 	G4int getRightPmtCopyNumber() const { return 2*parentCopyNum+1; }
 	
+	/** Get the copy number of the first scintillator segment
+	  */
+	G4int getFirstSegmentCopyNumber() const { return firstSegmentCopyNum; }
+	
+	/** Get the copy number following the last scintillator segment
+	  */
+	G4int getLastSegmentCopyNumber() const { return lastSegmentCopyNum; }
+	
 	/** Get a pointer to the vector representing the central position of this detector
 	  */
 	G4ThreeVector *getPosition(){ return &detectorPosition; }
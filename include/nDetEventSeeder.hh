@@ -0,0 +1,126 @@
+#ifndef NDET_EVENT_SEEDER_HH
+#define NDET_EVENT_SEEDER_HH
+
+#include <vector>
+#include <string>
+#include <utility>
+
+/** @class nDetEventSeeder
+  * @brief Reproducible per-event random number seeding and event range sharding
+  *
+  * The random number engine of the current thread is re-seeded at the start of each event using a state
+  * derived only from the master seed and the global ID of the event. Events are therefore identical
+  * regardless of the number of threads used, and a large simulation may be split into several shards
+  * (e.g. batch jobs) which, when combined, produce exactly the same events as a single job.
+  *
+  * Each run of N events in shard k (of K total shards) covers the global event IDs
+  * F + P*K + k*N to F + P*K + (k+1)*N - 1, where F is the first global event ID and P is the total number
+  * of events in all previous runs of the same job.
+  */
+
+class nDetEventSeeder{
+  public:
+	/** Destructor
+	  */
+	~nDetEventSeeder(){ }
+
+	/** Copy constructor. Not implemented for singleton class
+	  */
+	nDetEventSeeder(nDetEventSeeder const &copy);
+
+	/** Assignment operator. Not implemented for singleton class
+	  */
+	nDetEventSeeder &operator=(nDetEventSeeder const &copy);
+
+	/** Get an instance of this singleton
+	  */
+	static nDetEventSeeder &getInstance(){
+		// The only instance
+		// Guaranteed to be lazy initialized
+		// Guaranteed that it will be destroyed correctly
+		static nDetEventSeeder instance;
+		return instance;
+	}
+
+	/** Get the master random seed
+	  */
+	long getMasterSeed() const { return masterSeed; }
+
+	/** Get the index of this shard
+	  */
+	long getShardIndex() const { return shardIndex; }
+
+	/** Get the total number of shards
+	  */
+	long getShardCount() const { return shardCount; }
+
+	/** Get the global ID of the first event of the job
+	  */
+	long getFirstEvent() const { return firstEvent; }
+
+	/** Get the global ID of event zero of the current run
+	  */
+	long getRunOffset() const { return runOffset; }
+
+	/** Get the global ID of an event of the current run
+	  * @param eventID The ID of the event within the current run
+	  */
+	long getGlobalEventID(const long &eventID) const { return (runOffset + eventID); }
+
+	/** Set the master random seed
+	  */
+	void setMasterSeed(const long &seed){ masterSeed = seed; }
+
+	/** Set the index of this shard and the total number of shards
+	  * @return True if 0 <= @a index < @a count and return false otherwise
+	  */
+	bool setShard(const long &index, const long &count);
+
+	/** Set the global ID of the first event of the job
+	  * @return True if @a id is not negative and return false otherwise
+	  */
+	bool setFirstEvent(const long &id);
+
+	/** Compute the global event ID offset for a new run
+	  * @note Must be called from the master thread before any events of the run are generated
+	  * @param runID The ID of the new run
+	  * @param numEvents The number of events which will be processed by this shard during the run
+	  */
+	void beginRun(const int &runID, const long &numEvents);
+
+	/** Seed the random number engine of the current thread for an event of the current run
+	  * @param eventID The ID of the event within the current run
+	  */
+	void seedEvent(const long &eventID) const ;
+
+	/** Derive a pair of engine seeds from the master seed and a global event ID
+	  * @param seed The master random seed
+	  * @param globalID The global ID of the event
+	  * @param seeds Array of length 3 which will be filled with two non-zero seeds followed by a zero terminator
+	  */
+	static void deriveSeeds(const long &seed, const long &globalID, long *seeds);
+
+	/** Get a string describing the seeding scheme and the sharding parameters
+	  */
+	std::string getSchemeString() const ;
+
+	/** Get a string containing the global event ID offset of all runs, formatted as "run:offset run:offset ..."
+	  */
+	std::string getOffsetString() const ;
+
+  private:
+	long masterSeed; ///< The master random seed
+	long shardIndex; ///< The index of this shard
+	long shardCount; ///< The total number of shards
+	long firstEvent; ///< The global ID of the first event of the job
+	long runOffset; ///< The global ID of event zero of the current run
+	long eventsProcessed; ///< Total number of events in all previous runs of this job
+
+	std::vector<std::pair<int, long> > runOffsets; ///< The global event ID offset of all runs
+
+	/** Private constructor (for singleton class)
+	  */
+	nDetEventSeeder() : masterSeed(0), shardIndex(0), shardCount(1), firstEvent(0), runOffset(0), eventsProcessed(0) { }
+};
+
+#endif
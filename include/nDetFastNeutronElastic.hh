@@ -0,0 +1,177 @@
+#ifndef NDET_FAST_NEUTRON_ELASTIC_HH
+#define NDET_FAST_NEUTRON_ELASTIC_HH
+
+#include <vector>
+#include <string>
+
+#include "G4HadronicInteraction.hh"
+#include "G4VCrossSectionDataSet.hh"
+#include "G4VPhysicsConstructor.hh"
+
+class G4Material;
+class G4VPhysicalVolume;
+class G4HadronicProcess;
+
+/** @class nDetFastNeutronElasticXS
+  * @brief Tabulated neutron elastic cross sections of hydrogen and carbon inside the scintillator materials
+  *
+  * Only applicable to materials registered by nDetFastNeutronElastic and to neutron energies covered by its
+  * tables. The default cross sections of the elastic process (i.e. HP) are used everywhere else.
+  */
+
+class nDetFastNeutronElasticXS : public G4VCrossSectionDataSet {
+  public:
+	/** Default constructor
+	  */
+	nDetFastNeutronElasticXS() : G4VCrossSectionDataSet("nDetFastNeutronElasticXS") { }
+
+	/** Destructor
+	  */
+	virtual ~nDetFastNeutronElasticXS(){ }
+
+	/** Return true if the cross section of element @a Z in material @a mat is tabulated for the energy of @a particle and return false otherwise
+	  */
+	virtual G4bool IsElementApplicable(const G4DynamicParticle *particle, G4int Z, const G4Material *mat=0);
+
+	/** Get the tabulated elastic cross section of element @a Z for the energy of @a particle
+	  */
+	virtual G4double GetElementCrossSection(const G4DynamicParticle *particle, G4int Z, const G4Material *mat=0);
+
+	/** Add a material for which the tabulated cross sections will be used
+	  */
+	void addMaterial(const G4Material *mat){ materials.push_back(mat); }
+
+	/** Return true if the tabulated cross sections are used for material @a mat and return false otherwise
+	  */
+	bool hasMaterial(const G4Material *mat) const ;
+
+  private:
+	std::vector<const G4Material*> materials; ///< Materials for which the tabulated cross sections are used
+};
+
+/** @class nDetFastNeutronElastic
+  * @brief Fast tabulated n-p and n-C elastic scattering model for hydrocarbon scintillators
+  *
+  * Neutron elastic scattering on hydrogen and carbon is sampled using energy-gridded cross section and center-of-mass
+  * angular distribution tables. The tables are built once by the master thread, from the HP cross sections and by sampling
+  * the HP final states inside one of the scintillators, so the model reproduces HP up to the granularity of the tables while
+  * skipping the generic HP machinery on every scatter. Recoil protons and carbon ions are produced as secondaries, so their
+  * light output is handled by the usual per-particle scintillation yields.
+  *
+  * The model replaces HP only in scintillator materials composed solely of hydrogen and carbon. HP is deactivated in all
+  * hydrocarbon materials and this model is deactivated in all other materials, so exactly one of the two models is selected
+  * in each material. Neutrons in hydrocarbons which are not registered, or outside of the tabulated energy range, are passed
+  * to the HP model.
+  */
+
+class nDetFastNeutronElastic : public G4HadronicInteraction {
+  public:
+	/** Constructor
+	  * @param hp Pointer to the HP elastic model of the neutron elastic process
+	  * @param process Pointer to the neutron elastic process
+	  * @param xs Pointer to the tabulated cross section data set added to the neutron elastic process
+	  */
+	nDetFastNeutronElastic(G4HadronicInteraction *hp, G4HadronicProcess *process, nDetFastNeutronElasticXS *xs);
+
+	/** Destructor
+	  */
+	virtual ~nDetFastNeutronElastic(){ }
+
+	/** Return true if the projectile is inside a material composed solely of hydrogen and carbon and return false otherwise
+	  */
+	virtual G4bool IsApplicable(const G4HadProjectile &proj, G4Nucleus &target);
+
+	/** Sample an elastic scatter of a neutron on a target nucleus
+	  * @note Targets other than hydrogen and carbon, materials which are not registered, and energies outside of the tables, are passed to the HP model
+	  */
+	virtual G4HadFinalState *ApplyYourself(const G4HadProjectile &proj, G4Nucleus &target);
+
+	/** Assign each new material to either HP or this model, register the scintillator materials of the current geometry
+	  * and build the tables (master thread only, once)
+	  */
+	virtual void BuildPhysicsTable(const G4ParticleDefinition &particle);
+
+	/** Return true if the tables have been built and return false otherwise
+	  */
+	static bool getTablesBuilt(){ return tablesBuilt; }
+
+	/** Return true if neutron energy @a energy is covered by the tables and return false otherwise
+	  */
+	static bool isTabulated(const G4double &energy);
+
+	/** Get the tabulated elastic cross section of element @a Z
+	  * @param Z Atomic number of the target (1 or 6)
+	  * @param energy Neutron kinetic energy
+	  * @return The interpolated cross section or zero if @a Z is not tabulated
+	  */
+	static G4double getCrossSection(const G4int &Z, const G4double &energy);
+
+	/** Write the tables to a physics table cache directory, unless they are already stored there
+	  * @param dir Path to an existing cache sub-directory
+	  * @return True if the tables were written and return false otherwise
+	  */
+	static bool storeTables(const std::string &dir);
+
+  private:
+	G4HadronicInteraction *hpModel; ///< Pointer to the HP elastic model used outside of the tables
+	G4HadronicProcess *elasticProcess; ///< Pointer to the neutron elastic process
+	nDetFastNeutronElasticXS *crossSections; ///< Pointer to the tabulated cross section data set
+
+	std::vector<const G4Material*> rejectedMaterials; ///< Scintillator materials which contain elements other than hydrogen and carbon
+
+	size_t numMaterials; ///< Number of materials in the material table which have been assigned to either HP or this model
+
+	static bool tablesBuilt; ///< Flag indicating that the tables have been built
+	static std::vector<G4double> xsTable[2]; ///< Elastic cross section of hydrogen and carbon on a logarithmic energy grid
+	static std::vector<G4double> angTable[2]; ///< Center-of-mass cosine quantiles of hydrogen and carbon on a logarithmic energy grid
+	static std::string tablesMaterial; ///< Name of the scintillator material used to build the tables
+
+	/** Build the cross section and angular distribution tables using HP
+	  * @param particle The neutron definition
+	  * @param volume Physical volume of a scintillator used to sample the HP final states
+	  * @return True if the tables were built and return false otherwise
+	  */
+	bool buildTables(const G4ParticleDefinition &particle, G4VPhysicalVolume *volume);
+
+	/** Read the tables from a physics table cache directory
+	  * @param dir Path to the cache sub-directory for the current materials and production cuts
+	  * @return True if tables built with the same grids were found and return false otherwise
+	  */
+	static bool retrieveTables(const std::string &dir);
+
+	/** Get the path to the tables file of the current scintillator material inside cache directory @a dir
+	  */
+	static std::string getTablesFilename(const std::string &dir);
+
+	/** Sample the center-of-mass scattering angle cosine of a neutron
+	  * @param index Table index of the target (0 for hydrogen and 1 for carbon)
+	  * @param energy Neutron kinetic energy
+	  */
+	G4double sampleCosTheta(const int &index, const G4double &energy) const ;
+};
+
+/** @class nDetFastNeutronPhysics
+  * @brief Adds the fast tabulated n-p and n-C elastic model to the neutron elastic process of an HP physics list
+  */
+
+class nDetFastNeutronPhysics : public G4VPhysicsConstructor {
+  public:
+	/** Default constructor
+	  */
+	nDetFastNeutronPhysics() : G4VPhysicsConstructor("nDetFastNeutronPhysics") { }
+
+	/** Destructor
+	  */
+	virtual ~nDetFastNeutronPhysics(){ }
+
+	/** Nothing to do, all particles are defined by the reference physics list
+	  */
+	virtual void ConstructParticle(){ }
+
+	/** Add the tabulated cross sections and the fast model to the neutron elastic process
+	  * @note Must be registered after the hadron elastic physics of the reference physics list
+	  */
+	virtual void ConstructProcess();
+};
+
+#endif
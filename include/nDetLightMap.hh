@@ -0,0 +1,178 @@
+#ifndef NDET_LIGHT_MAP_HH
+#define NDET_LIGHT_MAP_HH
+
+#include <vector>
+#include <string>
+#include <mutex>
+
+#include "G4ThreeVector.hh"
+
+class TFile;
+
+/** @class nDetLightMap
+  * @brief Per-voxel optical photon detection map for a single detector
+  *
+  * The light map divides the body of a detector into a regular grid of voxels (in the local frame of the
+  * detector). For optical photons born inside each voxel, the map stores the probability of detection by
+  * each PMT, the distribution of arrival times (relative to the birth of the photon), and the distribution
+  * of hit positions on the photo-sensitive surface. Maps are built once per geometry using full optical
+  * photon transport and may then be used to sample PMT hits without tracking any optical photons.
+  */
+
+class nDetLightMap{
+  public:
+	/** Light map operating modes
+	  */
+	enum mapMode {OFF, BUILD, FAST};
+
+	/** Default constructor
+	  */
+	nDetLightMap();
+
+	/** Destructor
+	  */
+	~nDetLightMap(){ }
+
+	/** Return true if the map has not been initialized and return false otherwise
+	  */
+	bool empty() const { return (nVoxels == 0); }
+
+	/** Get the total number of voxels in the map
+	  */
+	size_t getNumVoxels() const { return nVoxels; }
+
+	/** Get the size of the mapped volume (in mm)
+	  */
+	G4ThreeVector getSize() const { return size; }
+
+	/** Get the total number of optical photons which were generated inside the mapped volume
+	  */
+	double getNumGenerated() const ;
+
+	/** Get the total number of optical photons which were detected by the left (@a isLeft = true) or right PMT
+	  */
+	double getNumDetected(const bool &isLeft) const ;
+
+	/** Initialize the map and zero all voxels
+	  * @param size_ The size of the mapped volume (in mm). The volume is centered on the origin of the detector
+	  * @param faceWidth_ The width of the photo-sensitive surface (in mm)
+	  * @param faceHeight_ The height of the photo-sensitive surface (in mm)
+	  * @return True if the map was initialized successfully and return false otherwise
+	  */
+	bool initialize(const G4ThreeVector &size_, const double &faceWidth_, const double &faceHeight_);
+
+	/** Set the number of voxels along each axis of the mapped volume
+	  * @note Takes effect the next time the map is initialized
+	  */
+	void setNumVoxels(const short &nx, const short &ny, const short &nz);
+
+	/** Set the number of photon arrival time bins and the maximum arrival time (in ns)
+	  * @note Takes effect the next time the map is initialized
+	  */
+	void setTimeBins(const short &nbins, const double &tmax);
+
+	/** Set the number of hit position bins along the horizontal and vertical axes of the photo-sensitive surface
+	  * @note Takes effect the next time the map is initialized
+	  */
+	void setPositionBins(const short &nx, const short &ny);
+
+	/** Copy all binning parameters from another map
+	  */
+	void copyBinning(const nDetLightMap &other);
+
+	/** Check whether a layout matches the current map
+	  * @param size_ The size of the mapped volume (in mm)
+	  * @return True if the map is initialized and the size of the mapped volume matches @a size_ and return false otherwise
+	  */
+	bool checkSize(const G4ThreeVector &size_) const ;
+
+	/** Find the voxel containing a position
+	  * @param pos Position in the local frame of the detector (in mm)
+	  * @param index The index of the voxel containing @a pos
+	  * @return True if the position is inside the mapped volume and return false otherwise
+	  */
+	bool findVoxel(const G4ThreeVector &pos, size_t &index) const ;
+
+	/** Record an optical photon generated at a position inside the mapped volume
+	  * @param pos Birth position of the photon in the local frame of the detector (in mm)
+	  * @note This method is mutex protected for safe multi-threading
+	  */
+	void addGenerated(const G4ThreeVector &pos);
+
+	/** Record an optical photon which was detected by one of the PMTs
+	  * @param pos Birth position of the photon in the local frame of the detector (in mm)
+	  * @param isLeft Flag indicating that the photon was detected by the left PMT
+	  * @param dt Time between the birth of the photon and its detection (in ns)
+	  * @param hit Position of the detection point in the local frame of the detector (in mm)
+	  * @note This method is mutex protected for safe multi-threading
+	  */
+	void addDetected(const G4ThreeVector &pos, const bool &isLeft, const double &dt, const G4ThreeVector &hit);
+
+	/** Sample a PMT hit for an optical photon generated inside a voxel
+	  * @param index The index of the voxel inside which the photon was generated
+	  * @param isLeft Returned flag indicating that the photon was detected by the left PMT
+	  * @param dt Returned time between the birth of the photon and its detection (in ns)
+	  * @param hit Returned position of the detection point in the local frame of the detector (in mm)
+	  * @return True if the photon was detected by one of the PMTs and return false otherwise
+	  */
+	bool sample(const size_t &index, bool &isLeft, double &dt, G4ThreeVector &hit) const ;
+
+	/** Compute the cumulative distributions used for sampling. Must be called before sample()
+	  */
+	void finalize();
+
+	/** Write the map to an open root file
+	  * @param f Pointer to the output root file
+	  * @param name Name of the TTree which will be written to the file
+	  * @return True if the map was written successfully and return false otherwise
+	  */
+	bool write(TFile *f, const std::string &name) const ;
+
+	/** Read the map from an open root file
+	  * @param f Pointer to the input root file
+	  * @param name Name of the TTree which will be read from the file
+	  * @return True if the map was read successfully and return false otherwise
+	  */
+	bool read(TFile *f, const std::string &name);
+
+	/** Print information about the map to stdout
+	  */
+	void print() const ;
+
+  private:
+	short nBinsX; ///< Number of voxels along the X-axis of the detector
+	short nBinsY; ///< Number of voxels along the Y-axis of the detector
+	short nBinsZ; ///< Number of voxels along the Z-axis of the detector
+	short nTimeBins; ///< Number of photon arrival time bins
+	short nPosBinsX; ///< Number of horizontal hit position bins
+	short nPosBinsY; ///< Number of vertical hit position bins
+
+	size_t nVoxels; ///< Total number of voxels in the map
+
+	double tMax; ///< Maximum photon arrival time (in ns). Later photons are added to the final time bin
+	double faceWidth; ///< Width of the photo-sensitive surface (in mm)
+	double faceHeight; ///< Height of the photo-sensitive surface (in mm)
+
+	G4ThreeVector size; ///< Size of the mapped volume (in mm)
+	G4ThreeVector voxelSize; ///< Size of each voxel (in mm)
+
+	std::vector<double> nGenerated; ///< Number of photons generated in each voxel
+	std::vector<double> nDetected; ///< Number of photons detected by each PMT for each voxel
+	std::vector<double> hitSumZ; ///< Sum of the Z-position of all hits on each PMT for each voxel
+	std::vector<float> timeHist; ///< Photon arrival time histogram of each PMT for each voxel
+	std::vector<float> posHist; ///< Photon hit position histogram of each PMT for each voxel
+
+	std::vector<float> timeCdf; ///< Cumulative photon arrival time distribution of each PMT for each voxel
+	std::vector<float> posCdf; ///< Cumulative photon hit position distribution of each PMT for each voxel
+
+	std::mutex mapLock; ///< Mutex lock for thread-safe map building
+
+	/** Sample a bin from a cumulative distribution using a binary search
+	  * @param cdf Pointer to the first element of the cumulative distribution
+	  * @param N The number of bins in the distribution
+	  * @return The index of the selected bin
+	  */
+	size_t sampleCdf(const float *cdf, const size_t &N) const ;
+};
+
+#endif
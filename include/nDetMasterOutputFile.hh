@@ -1,7 +1,11 @@
 #ifndef NDET_MASTER_OUTPUT_FILE_HH
 #define NDET_MASTER_OUTPUT_FILE_HH
 
+#include <vector>
+#include <string>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
 
 #include "centerOfMass.hh"
 #include "nDetDataPack.hh"
@@ -24,6 +28,10 @@ class nDetMasterOutputFileMessenger;
 
 class nDetMasterOutputFile{
   public:
+	/** Per-thread output modes
+	  */
+	enum shardMode {SINGLE, MERGE, CHAIN};
+
 	/** Destructor
 	  */
 	~nDetMasterOutputFile();
@@ -41,7 +49,8 @@ class nDetMasterOutputFile{
 	static nDetMasterOutputFile &getInstance();
 
 	/** Safely fill the output branches (thread safe)
-	  * @param pack Data structure to copy simulation data from
+	  * @param pack Data pack pointing to the simulation data of the calling thread. The output tree reads directly from
+	  *             these structures (no copy is made) unless the asynchronous writer thread is enabled
 	  * @return True if file output is enabled and return false otherwise
 	  */
 	bool fillBranch(const nDetDataPack &pack);
@@ -91,6 +100,38 @@ class nDetMasterOutputFile{
 	  */	
 	void setOutputBadEvents(const bool &enabled){ outputBadEvents = enabled; }
 
+	/** Set the per-thread output mode. In multithreaded mode, each worker thread may write to its own output file
+	  * in order to avoid locking the output file for every event. The available modes are described below
+	  *
+	  * | Mode             | Description |
+	  * |------------------|-------------|
+	  * | SINGLE (default) | All threads write to a single output tree |
+	  * | MERGE            | Each thread writes to its own file. The files are merged into the output file when it is closed |
+	  * | CHAIN            | Each thread writes to its own file. A TChain of all files and an index tree are written to the output file |
+	  *
+	  * @note Takes effect the next time the output file is opened. Ignored in sequential mode
+	  */
+	void setShardMode(const shardMode &mode){ outputShardMode = mode; }
+
+	/** Set the per-thread output mode using a string ("false", "merge", or "chain")
+	  * @return True if the mode is valid and return false otherwise
+	  */
+	bool setShardMode(const std::string &mode);
+
+	/** Set the maximum number of events waiting to be written by the asynchronous writer thread
+	  * 
+	  * If @a size is greater than zero, fillBranch() copies each event into a recycled buffer and pushes it onto
+	  * a bounded queue. A dedicated writer thread drains the queue into the output tree so that compression and
+	  * disk output do not stall the simulation threads. Threads will only wait when the queue is full
+	  * @param size The maximum number of queued events. If equal to zero, the writer thread is disabled (default)
+	  * @note Takes effect the next time the output file is opened. Not used with per-thread output files
+	  */
+	void setWriterQueueSize(const size_t &size){ writerQueueSize = size; }
+
+	/** Get the maximum number of events which were waiting in the writer queue at the same time
+	  */
+	size_t getMaxQueueDepth() const { return maxQueueDepth; }
+
 	/** Enable or disable over-writing of the output file
 	  */
 	void setOverwriteOutputFile(const bool &overwrite){ overwriteExistingFile = overwrite; }
@@ -143,6 +184,41 @@ class nDetMasterOutputFile{
 	void printMessage(const G4String &msg) const ;
 
   private:
+	/** @class outputShard
+	  * @brief Output file and TTree owned by a single worker thread
+	  */
+	class outputShard{
+	  public:
+		TFile *file; ///< Pointer to the thread-local output file
+		TTree *tree; ///< Pointer to the thread-local output tree
+		
+		nDetDataPack data; ///< Structure pointers bound to the branches of the thread-local tree (points to the data of the thread)
+		
+		/** Default constructor
+		  */
+		outputShard() : file(NULL), tree(NULL) { }
+	};
+
+	/** @class outputBuffer
+	  * @brief Snapshot of a single event waiting to be written by the asynchronous writer thread
+	  */
+	class outputBuffer{
+	  public:
+		nDetEventStructure evtData; ///< Data structure containing Geant4 event information
+		nDetOutputStructure outData; ///< Data structure containing normal (single-detector) output variables
+		nDetMultiOutputStructure multData; ///< Data structure containing multi-detector output variables
+		nDetDebugStructure debugData; ///< Data structure containing debug output variables
+		nDetTraceStructure traceData; ///< Data structure containing PMT response light pulses
+		
+		nDetDataPack data; ///< Pointers to the data structures of this buffer
+
+		int eventID; ///< The ID of the event
+		
+		/** Default constructor
+		  */
+		outputBuffer() : data(&evtData, &outData, &multData, &debugData, &traceData), eventID(0) { }
+	};
+
 	std::mutex fileLock; ///< Mutex lock for thread-safe TTree filling
 
 	std::string filename; ///< Default time & date filename when output filename unspecified by user
@@ -157,6 +233,28 @@ class nDetMasterOutputFile{
 	TFile *fFile; ///< Pointer to the output root file
 	TTree *fTree; ///< Pointer to the output TTree
 
+	nDetDataPack treeData; ///< Structure pointers bound to the branches of the output tree
+
+	shardMode outputShardMode; ///< Per-thread output mode
+	std::vector<outputShard*> shards; ///< Output files of all worker threads (per-thread output modes only)
+
+	std::thread *writerThread; ///< Pointer to the asynchronous writer thread (if enabled)
+	std::mutex queueLock; ///< Mutex lock protecting the writer queue and the buffer pool
+	std::condition_variable queueNotEmpty; ///< Signals the writer thread that an event was added to the queue
+	std::condition_variable queueNotFull; ///< Signals waiting threads that a buffer was returned to the pool
+	std::vector<outputBuffer*> writerQueue; ///< Ring buffer of events waiting to be written
+	std::vector<outputBuffer*> bufferPool; ///< Recycled event buffers which are not currently in use
+	size_t writerQueueSize; ///< Maximum number of events which may wait in the writer queue (zero disables the writer thread)
+	size_t queueHead; ///< Index of the oldest event in the writer queue
+	size_t queueDepth; ///< Number of events currently in the writer queue
+	size_t buffersInUse; ///< Number of buffers which have been taken from the pool and not yet returned
+	bool stopWriter; ///< Flag telling the writer thread to drain the queue and exit
+
+	size_t maxQueueDepth; ///< Maximum number of events waiting in the queue during the current file
+	unsigned long long numQueued; ///< Total number of events pushed onto the queue during the current file
+	unsigned long long sumQueueDepth; ///< Sum of the queue depth at the time of each push (for the average depth)
+	unsigned long long numStalls; ///< Number of times a thread had to wait for a free buffer
+
 	bool persistentMode; ///< Flag indicating whether or not the output file should remain open for subsequent runs
 	bool verbose; ///< Verbosity flag
 	
@@ -184,6 +282,42 @@ class nDetMasterOutputFile{
 
 	nDetMasterOutputFileMessenger *fMessenger; ///< Pointer to the messenger object used for this class
 
+	/** Open one output file for each worker thread
+	  * @return True if all files are opened successfully and return false otherwise
+	  */
+	bool openShards();
+
+	/** Close all per-thread output files and merge or chain them into the output file
+	  */
+	void closeShards();
+
+	/** Start the asynchronous writer thread
+	  */
+	void startWriter();
+
+	/** Drain the writer queue, stop the asynchronous writer thread, and print queue statistics
+	  */
+	void stopWriterThread();
+
+	/** Main loop of the asynchronous writer thread
+	  */
+	void writerLoop();
+
+	/** Copy an event into a recycled buffer and push it onto the writer queue. Waits if the queue is full
+	  * @note Events which will not be written to the output tree must not be pushed
+	  */
+	void pushEvent(const nDetDataPack &pack);
+
+	/** Print the simulation rate for an event written by any thread, or start the timer for the first event
+	  * @note The status output is skipped if another thread is already updating the status
+	  */
+	void updateStatus(const int &eventID);
+
+	/** Print the simulation rate to stdout (if enough time has passed since the previous update)
+	  * @param eventID The ID of the current event
+	  */
+	void printStatus(const int &eventID);
+
 	/** Default constructor (private because we must only have one instance of the output file)
 	  */
 	nDetMasterOutputFile();	
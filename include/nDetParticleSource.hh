@@ -56,6 +56,20 @@ class nDetParticleSource : public G4GeneralParticleSource {
 	  */
 	nDetParticleSourceMessenger *GetMessenger(){ return fSourceMessenger; }
 
+	/** Create a new thread-local copy of this source for use by a worker thread
+	  * 
+	  * The copy shares the single particle sources of this object (which are safe for concurrent sampling), but
+	  * owns all other mutable generator state, so that worker threads may generate primaries without locking.
+	  * The configuration of the copy is updated from this source every time UpdateAll() is called
+	  * @note The returned pointer is owned by the caller and must be deleted when the worker thread exits
+	  * @return A pointer to the new thread-local source
+	  */
+	nDetParticleSource *CreateThreadLocalCopy();
+
+	/** Return true if this is a thread-local copy of the master source and return false otherwise
+	  */
+	bool IsThreadLocal() const { return (master != NULL); }
+
 	/** Get the time offset due to primary particle straggling in the target (in ns)
 	  */
 	double GetTargetTimeOffset() const { return targTimeOffset; }
@@ -238,7 +252,9 @@ class nDetParticleSource : public G4GeneralParticleSource {
 	  */
 	void Reset();
 
-	/** Update the position & rotation of the source and set the beam profile
+	/** Update the position & rotation of the source and set the beam profile, and copy the configuration
+	  * of this source to all thread-local copies
+	  * @note Must only be called while worker threads are not generating events (i.e. at the start of a run)
 	  */
 	void UpdateAll();
 
@@ -268,7 +284,7 @@ class nDetParticleSource : public G4GeneralParticleSource {
 	double Print(const size_t &Nsamples=1);
 
 	/** Generate primary particles
-	  * @note This method is mutex protected for safe multi-threading
+	  * @note In multithreaded mode, each worker thread must use its own copy of the source (see CreateThreadLocalCopy())
 	  * @param anEvent Pointer to the current event
 	  */
 	virtual void GeneratePrimaries(G4Event* anEvent);
@@ -315,12 +331,25 @@ class nDetParticleSource : public G4GeneralParticleSource {
 
 	double b2bEnergy[2]; ///< Array containing particle energies for back-to-back particle emitter state
 
-	std::mutex generatorLock; ///< Mutex lock for thread-safe TTree filling
+	nDetParticleSource *master; ///< Pointer to the master source (for thread-local copies only)
+
+	std::vector<nDetParticleSource*> threadLocalCopies; ///< Vector of all thread-local copies of this source
+	
+	std::mutex copyLock; ///< Mutex lock protecting the vector of thread-local copies
 
 	/** Default constructor (private for singleton class)
 	  */
 	nDetParticleSource(nDetDetector *det=NULL);
 
+	/** Thread-local copy constructor (see CreateThreadLocalCopy())
+	  * @param master_ Pointer to the master source
+	  */
+	nDetParticleSource(nDetParticleSource *master_);
+
+	/** Copy all source parameters, except the single particle sources themselves, from another source
+	  */
+	void CopyConfiguration(const nDetParticleSource &other);
+
 	/** Get the next G4SingleParticleSource in the vector of all sources
 	  * @return A pointer to the next source (starting from the zeroth) or return NULL if the end of the vector has been reached
 	  */
@@ -368,8 +397,9 @@ class nDetParticleSource : public G4GeneralParticleSource {
   * @date June 5, 2019
   *
   * This class is necessary because the actual primary particle generator class (nDetParticleSource)
-  * is a singleton and the program will crash when Geant attempts to delete it. This class is not
-  * associated with the singleton class and only uses a pointer to the instance of the singleton.
+  * is a singleton and the program will crash when Geant attempts to delete it. In sequential mode, this
+  * class only uses a pointer to the instance of the singleton. On worker threads, it owns a thread-local
+  * copy of the singleton so that primaries are generated without any locking.
   */
 
 class nDetPrimaryGeneratorAction : public G4VUserPrimaryGeneratorAction{
@@ -380,16 +410,21 @@ class nDetPrimaryGeneratorAction : public G4VUserPrimaryGeneratorAction{
 	
 	/** Destructor
 	  */
-	~nDetPrimaryGeneratorAction(){ }
+	~nDetPrimaryGeneratorAction();
+	
+	/** Get a pointer to the particle source used by this thread
+	  */
+	nDetParticleSource *getParticleSource(){ return source; }
 	
 	/** Generate primary particles
-	  * @note The particle generator method nDetParticleSource::GeneratePrimaries() is mutex protected for safe multi-threading
 	  * @param anEvent Pointer to the current event
 	  */
 	virtual void GeneratePrimaries(G4Event* anEvent);
 	
   private:
-	nDetParticleSource *source; ///< Pointer to the primary particle generator singleton
+	nDetParticleSource *source; ///< Pointer to the primary particle generator singleton or to a thread-local copy
+
+	bool threadLocal; ///< Flag indicating that the particle source is a thread-local copy owned by this object
 };
 
 #endif
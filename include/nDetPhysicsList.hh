@@ -0,0 +1,62 @@
+#ifndef NDET_PHYSICS_LIST_HH
+#define NDET_PHYSICS_LIST_HH
+
+#include <string>
+
+class G4VModularPhysicsList;
+
+/** @class nDetPhysicsList
+  * @brief Builds the physics list used by NEXTSim for one of several physics profiles
+  *
+  * The full profile (QGSP_BERT_HP with optical physics) is required for neutron simulations. Calibration runs
+  * do not need any hadronic physics, so they may use the much lighter EM+optical profile (gamma and beta sources)
+  * or the optical-only profile (laser sources). All particles are defined by every profile, but particles without
+  * physics processes are only transported. The fast profile is the full profile with fast tabulated n-p and n-C elastic
+  * scattering inside the scintillators (see nDetFastNeutronElastic).
+  */
+
+class nDetPhysicsList{
+  public:
+	/** Available physics profiles
+	  */
+	enum physicsProfile {OPTICAL, EM, FULL, FAST};
+
+	/** Get a physics profile from its name
+	  * @param name Name of the profile ("optical", "em", "full", or "fast")
+	  * @param profile The physics profile corresponding to the input name
+	  * @return True if the profile name is valid and return false otherwise
+	  */
+	static bool getProfile(const std::string &name, physicsProfile &profile);
+
+	/** Select the lightest physics profile which supports the source type defined in a macro
+	  * @note The last "/nDet/source/type" command is used, along with any discrete levels added to it. Macros called using "/control/execute" are
+	  *       also searched. The full profile is selected if the source cannot be classified, i.e. if no source type is found or if a neutron level,
+	  *       a reaction, an energy distribution file, a source reset, or a Geant particle source or gun is used
+	  * @param filename Path to the macro file
+	  */
+	static physicsProfile getProfileFromMacro(const std::string &filename);
+
+	/** Get the name of a physics profile
+	  */
+	static std::string getProfileName(const physicsProfile &profile);
+
+	/** Get the name of the physics list built for a physics profile
+	  */
+	static std::string getPhysicsListName(const physicsProfile &profile);
+
+	/** Build a new physics list for a physics profile
+	  * @note Ownership of the returned list is passed to the caller (normally the run manager)
+	  */
+	static G4VModularPhysicsList *build(const physicsProfile &profile);
+
+  private:
+	/** Search a macro file for source commands
+	  * @param filename Path to the macro file
+	  * @param profile The physics profile required by the source commands found (not modified if none is found)
+	  * @param depth Current depth of nested macro files
+	  * @return True if a source command was found and return false otherwise
+	  */
+	static bool searchMacro(const std::string &filename, physicsProfile &profile, const int &depth=0);
+};
+
+#endif
@@ -18,13 +18,46 @@ class userActionManager;
 class nDetEventAction;
 class nDetStackingAction;
 class nDetTrackingAction;
-class nDetSteppingAction;
 class nDetConstruction;
 class pmtResponse;
 
 class photonCounter;
 class nDetParticleSource;
 
+/** @class copyNumberEntry
+  * @brief Entry in the copy number lookup tables of nDetRunAction
+  *
+  * Maps a single PMT or scintillator segment copy number to its detector and caches the transformation
+  * from the lab frame into the local frame of that detector
+  */
+
+class copyNumberEntry{
+  public:
+	nDetDetector *det; ///< Pointer to the detector which owns the copy number (NULL if the copy number is not used)
+	G4int detID; ///< Parent copy number of the detector
+	size_t index; ///< Index of the detector in the list of user detectors
+	G4int col; ///< Segmented detector column (segment copy numbers only)
+	G4int row; ///< Segmented detector row (segment copy numbers only)
+	bool isLeft; ///< Flag indicating the left PMT of the detector (PMT copy numbers only)
+
+	G4RotationMatrix rotation; ///< Rotation from the lab frame into the local frame of the detector
+	G4ThreeVector offset; ///< Position of the lab frame origin in the local frame of the detector
+
+	/** Default constructor
+	  */
+	copyNumberEntry() : det(NULL), detID(-1), index(0), col(0), row(0), isLeft(false), rotation(), offset() { }
+
+	/** Detector constructor. Caches the inverse transform of the detector
+	  * @param det_ Pointer to the detector
+	  * @param index_ Index of the detector in the list of user detectors
+	  */
+	copyNumberEntry(nDetDetector *det_, const size_t &index_);
+
+	/** Transform a position from the lab frame into the local frame of the detector
+	  */
+	G4ThreeVector toLocal(const G4ThreeVector &global) const { return (rotation*global + offset); }
+};
+
 /** @class primaryTrackInfo
   * @brief Container for primary particle scatter information
   * @author Cory R. Thornsberry (cthornsb@vols.utk.edu)
@@ -92,6 +125,10 @@ class primaryTrackInfo{
 class nDetRunAction : public G4UserRunAction
 {
   public:
+	/** Optical photon kill cuts
+	  */
+	enum photonCut {TIME_CUT, LENGTH_CUT, REFLECTION_CUT, OUTSIDE_CUT, NUM_PHOTON_CUTS};
+
 	/** Default constructor
 	  */
 	nDetRunAction();
@@ -112,6 +149,10 @@ class nDetRunAction : public G4UserRunAction
 	  */
 	nDetParticleSource *getParticleSource(){ return source; }
 
+	/** Set the particle source used by this thread (e.g. a thread-local copy of the master source)
+	  */
+	void setParticleSource(nDetParticleSource *src){ source = src; }
+
 	/** Set all user action pointers
 	  * @param action Pointer to thread-local user action manager
 	  */
@@ -189,7 +230,15 @@ class nDetRunAction : public G4UserRunAction
 	  */   
     unsigned long long getNumPhotonsDet() const { return numPhotonsDetTotal; }
 
-	/** Copy the list of defined detectors and set the start detector (if one exists)
+	/** Get the total number of optical photons killed by one of the optical photon cuts during this run (thread-local)
+	  */
+	unsigned long long getNumPhotonsCut(const photonCut &cut) const { return numPhotonsCut[cut]; }
+
+	/** Increment the number of optical photons killed by one of the optical photon cuts
+	  */
+	void countPhotonCut(const photonCut &cut){ numPhotonsCut[cut]++; }
+
+	/** Copy the list of defined detectors, set the start detector (if one exists), and build the copy number lookup tables
 	  * @param construction Pointer to the singleton detector constructor object
 	  */
 	void updateDetector(nDetConstruction *construction);
@@ -219,7 +268,68 @@ class nDetRunAction : public G4UserRunAction
 	  */
 	bool AddDetectedPhoton(const G4Step *step, const double &mass=1);
 
-	/** Set initial primary particle scatter information with parameters from a G4Step
+	/** Get the current light map operating mode
+	  */
+	nDetLightMap::mapMode getLightMapMode() const { return detector->GetLightMapMode(); }
+
+	/** Get the survival probability for newly generated optical photons
+	  */
+	G4double getPhotonSurvivalProbability() const { return detector->GetPhotonSurvivalProbability(); }
+
+	/** Get the maximum global time of optical photons for the current run (in ns). Return zero if the cut is disabled
+	  */
+	G4double getPhotonMaxTime() const { return detector->GetPhotonMaxTime(); }
+
+	/** Return true if an optical photon in a physical volume should be killed because it is outside of all detector assemblies and return false otherwise
+	  */
+	bool getPhotonOutsideDetectors(const G4VPhysicalVolume *physV) const { return (!detector->GetTrackPhotonsOutsideDetectors() && physV && !detector->IsInsideDetectors(physV)); }
+
+	/** Return true if optical photons are tracked in a second stacking stage and return false otherwise
+	  * @note Deferred tracking is not used while building light maps, since every generated photon must be tracked
+	  */
+	bool getDeferOpticalPhotons() const { return (detector->GetDeferOpticalPhotons() && detector->GetLightMapMode() != nDetLightMap::BUILD); }
+
+	/** Decide whether or not the optical photons of the current event should be tracked
+	  * @note Called once all other particles have been tracked (deferred optical photon tracking mode)
+	  * @return True if the primary particle entered a scintillator and deposited a non-zero energy of at least the trigger threshold and return false otherwise
+	  */
+	bool checkOpticalTrigger() const ;
+
+	/** Increment the number of events whose optical photons were not tracked because the event failed the optical trigger
+	  */
+	void countVetoedEvent(){ numEventsVetoed++; }
+
+	/** Get the total number of events whose optical photons were not tracked during this run (thread-local)
+	  */
+	unsigned long long getNumEventsVetoed() const { return numEventsVetoed; }
+
+	/** Return true if optical photon quantum efficiency pre-culling is enabled for the current run and return false otherwise
+	  */
+	bool getQuantumEfficiencyCulling() const { return (detector->GetQuantumEfficiencyCulling() != nDetConstruction::QE_CULL_OFF); }
+
+	/** Get the probability that a new optical photon survives quantum efficiency pre-culling
+	  * @param energy Total energy of the optical photon
+	  */
+	G4double getQuantumEfficiencySurvivalProbability(const G4double &energy) const ;
+
+	/** Record the birth of an optical photon in the light map of the detector inside of which it was generated (light map building mode)
+	  * @param track Pointer to the new optical photon track
+	  * @return True if the photon was generated inside a mapped detector and return false otherwise
+	  */
+	bool AddGeneratedPhoton(const G4Track *track);
+
+	/** Sample a PMT hit for a new optical photon from the light map of the detector inside of which it was generated (fast light map simulation mode)
+	  * @param track Pointer to the new optical photon track
+	  * @param mass The mass of the detection event for the center-of-mass weighted average
+	  * @return True if the photon was generated inside a mapped detector and may be killed and return false otherwise
+	  */
+	bool SampleLightMap(const G4Track *track, const double &mass=1);
+
+	/** Set the initial kinetic energy of the primary particle
+	  */
+	void setInitialEnergy(const G4double &energy){ evtData.nInitEnergy = energy; }
+
+	/** Set initial primary particle scatter information with parameters from the first G4Step inside a scintillator
 	  */
 	void initializeNeutron(const G4Step *step);
 
@@ -242,7 +352,6 @@ class nDetRunAction : public G4UserRunAction
 	nDetEventAction *eventAction; ///< Pointer to the thread-local user event action
 	nDetStackingAction *stacking; ///< Pointer to the thread-local user stacking action
 	nDetTrackingAction *tracking; ///< Pointer to the thread-local user tracking action
-	nDetSteppingAction *stepping; ///< Pointer to the thread-local user stepping action
 	
 	nDetConstruction *detector; ///< Pointer to the global detector singleton
 	nDetParticleSource *source; ///< Pointer to the thread-local particle source
@@ -263,11 +372,61 @@ class nDetRunAction : public G4UserRunAction
 
     unsigned long long numPhotonsTotal; ///< Total number of simulated optical photons (thread-local)
     unsigned long long numPhotonsDetTotal; ///< Total number of detected optical photons (thread-local)
+	unsigned long long numEventsVetoed; ///< Total number of events which failed the optical trigger (thread-local)
+	unsigned long long numPhotonsCut[NUM_PHOTON_CUTS]; ///< Total number of optical photons killed by each of the optical photon cuts (thread-local)
 
 	nDetDetector *startDetector; ///< Pointer to the detector used as a start signal for timing
 
 	std::vector<nDetDetector> userDetectors; ///< Vector of detectors added by the user
 
+	std::vector<size_t> hitDetectors; ///< Indices of all detectors which detected at least one photon during this event
+	std::vector<bool> detectorHit; ///< Flags indicating that a detector is already in the list of hit detectors
+
+	std::vector<copyNumberEntry> pmtLookup; ///< Lookup table mapping PMT copy numbers to detectors
+	std::vector<copyNumberEntry> segmentLookup; ///< Lookup table mapping scintillator segment copy numbers to detectors
+	std::vector<copyNumberEntry> assemblyLookup; ///< Lookup table mapping detector assembly copy numbers to detectors
+
+	/** Find the lookup table entry of a PMT copy number
+	  * @return A pointer to the matching entry or NULL if the copy number does not belong to any detector
+	  */
+	const copyNumberEntry *findPmt(const G4int &copyNum) const { return ((copyNum >= 0 && copyNum < (G4int)pmtLookup.size() && pmtLookup[copyNum].det) ? &pmtLookup[copyNum] : NULL); }
+
+	/** Find the lookup table entry of a scintillator segment copy number
+	  * @return A pointer to the matching entry or NULL if the copy number does not belong to any detector
+	  */
+	const copyNumberEntry *findSegment(const G4int &copyNum) const { return ((copyNum >= 0 && copyNum < (G4int)segmentLookup.size() && segmentLookup[copyNum].det) ? &segmentLookup[copyNum] : NULL); }
+
+	/** Find the lookup table entry of a detector assembly copy number
+	  * @return A pointer to the matching entry or NULL if the copy number does not belong to any detector
+	  */
+	const copyNumberEntry *findAssembly(const G4int &copyNum) const { return ((copyNum >= 0 && copyNum < (G4int)assemblyLookup.size() && assemblyLookup[copyNum].det) ? &assemblyLookup[copyNum] : NULL); }
+
+	/** Find the lookup table entry of the detector inside of which a new optical photon was generated
+	  * @return A pointer to the matching entry or NULL if the photon was not generated inside a detector
+	  */
+	const copyNumberEntry *findBirthDetector(const G4Track *track) const ;
+
+	/** Add a detector to the list of detectors hit during this event (if it is not already in the list)
+	  * @param index Index of the detector in the list of user detectors
+	  */
+	void markDetectorHit(const size_t &index){
+		if(!detectorHit[index]){
+			detectorHit[index] = true;
+			hitDetectors.push_back(index);
+		}
+	}
+
+	/** Set whether or not the quantum efficiency is applied to optical photons at birth for the PMTs of all detectors
+	  */
+	void setupQuantumEfficiencyCulling();
+
+	/** Accept or reject a detected optical photon which survived quantum efficiency pre-culling
+	  * @param cm Pointer to the center-of-mass calculator of the PMT which detected the photon
+	  * @param energy Total energy of the optical photon
+	  * @return True if the photon is accepted with probability QE(lambda)/p, where p is its pre-culling survival probability, and return false otherwise
+	  */
+	bool acceptCulledPhoton(centerOfMass *cm, const double &energy) const ;
+
 	/** Pop a primary scatter off the stack. Set all initial event conditions if this is the first scatter
 	  * @return True if the stack of primary scatters is not empty after popping off a scatter and return false otherwise
 	  */
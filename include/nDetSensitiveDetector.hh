@@ -0,0 +1,84 @@
+#ifndef NDET_SENSITIVE_DETECTOR_HH
+#define NDET_SENSITIVE_DETECTOR_HH
+
+#include "G4VSensitiveDetector.hh"
+
+class G4Step;
+class G4HCofThisEvent;
+class G4TouchableHistory;
+
+class nDetRunAction;
+class nDetConstruction;
+
+/** @class nDetPmtSensitiveDetector
+  * @brief Collects optical photons detected by the photo-sensitive surfaces of the PMTs
+  *
+  * Attached to the sensitive PMT logical volumes built by nDetDetector::constructPSPmts(). Detected optical
+  * photons never enter the sensitive volume, instead the optical boundary process invokes this detector when
+  * a photon is detected at the surface. Each detected photon is added to the center-of-mass calculator of
+  * the corresponding PMT.
+  */
+
+class nDetPmtSensitiveDetector : public G4VSensitiveDetector {
+  public:
+	/** Constructor
+	  * @param name The unique name of the sensitive detector
+	  */
+	nDetPmtSensitiveDetector(const G4String &name);
+
+	/** Destructor
+	  */
+	virtual ~nDetPmtSensitiveDetector(){ }
+
+	/** Get the user run action of the current thread. Called at the start of each event
+	  */
+	virtual void Initialize(G4HCofThisEvent*);
+
+	/** Add a detected optical photon to the PMT which detected it
+	  * @param step Pointer to the optical photon step which ended on the photo-sensitive surface
+	  * @return True if the photon was added to a PMT and return false otherwise
+	  */
+	virtual G4bool ProcessHits(G4Step *step, G4TouchableHistory*);
+
+  private:
+	nDetRunAction *runAction; ///< Pointer to the thread-local user run action
+};
+
+/** @class nDetScintSensitiveDetector
+  * @brief Records scatters of the primary particle inside the scintillator volumes
+  *
+  * Attached to all scintillator logical volumes. Only steps of the primary particle (track ID 1) are
+  * processed. The first such step initializes the primary scatter information, each step which reduces
+  * the kinetic energy of the primary is recorded as a scatter, and steps leaving the scintillator set the
+  * final primary particle information.
+  */
+
+class nDetScintSensitiveDetector : public G4VSensitiveDetector {
+  public:
+	/** Constructor
+	  * @param name The unique name of the sensitive detector
+	  */
+	nDetScintSensitiveDetector(const G4String &name);
+
+	/** Destructor
+	  */
+	virtual ~nDetScintSensitiveDetector(){ }
+
+	/** Get the user run action of the current thread and reset the primary particle flag. Called at the start of each event
+	  */
+	virtual void Initialize(G4HCofThisEvent*);
+
+	/** Record a primary particle step inside a scintillator
+	  * @param step Pointer to a step whose pre-step point lies inside a scintillator
+	  * @return True if the step was a primary particle scatter and return false otherwise
+	  */
+	virtual G4bool ProcessHits(G4Step *step, G4TouchableHistory*);
+
+  private:
+	nDetRunAction *runAction; ///< Pointer to the thread-local user run action
+	nDetConstruction *construction; ///< Pointer to the detector construction singleton (used for volume classification)
+
+	bool primaryEntered; ///< Flag indicating that the primary particle has entered a scintillator during this event
+};
+
+#endif
@@ -27,6 +27,12 @@ class nDetStackingAction : public G4UserStackingAction {
 
 	/** Classify a new particle track for the stack manager. If the track is
 	  * an optical photon, add it to the photon counter
+	  * @note Optical photons are thinned by russian roulette if the photon survival probability is less than one.
+	  *       Optical photons generated outside of the detectors or after the maximum optical photon time are killed.
+	  *       If quantum efficiency pre-culling is enabled, optical photons are also killed with the probability that they would not be detected by a PMT.
+	  *       In fast light map simulation mode, optical photons generated inside a mapped
+	  *       detector are killed and their PMT hits are sampled from the light map instead.
+	  *       In deferred tracking mode, all remaining optical photons are sent to the waiting stack
 	  */
 	G4ClassificationOfNewTrack ClassifyNewTrack(const G4Track* aTrack);
 
@@ -40,9 +46,10 @@ class nDetStackingAction : public G4UserStackingAction {
 
 	/** Called by G4StackManager when the urgent stack is empty and contents 
 	  * of the waiting stack are transferred to the urgent stack
-	  * @note Currently does nothing
+	  * @note In deferred optical photon tracking mode, the waiting stack contains only optical photons. All of them
+	  *       are discarded if the event fails the optical trigger
 	  */
-	void NewStage(){ }
+	void NewStage();
 
 	/** Called by G4StackManager at the beginning of each primary event
 	  * @note Currently does nothing
@@ -3,37 +3,47 @@
 
 #include "G4UserSteppingAction.hh"
 
+class G4Step;
+class G4OpBoundaryProcess;
+
 class nDetConstruction;
 class nDetRunAction;
 
 /** @class nDetSteppingAction
-  * @brief Performs actions which take place at the start and end of processing of a particle step
-  * @date August 9, 2019
+  * @brief Enforces the optical photon global time, track length, and boundary reflection cuts and kills particles leaving the detectors
+  *
+  * Photons which can no longer contribute to the digitized PMT traces (arriving after the end of the
+  * acquisition window, or leaving the detectors) or which are trapped in long internal reflection loops are killed. Other particles
+  * are killed in the world volume if they can no longer reach a detector (see nDetConstruction::InitializeKillMode()).
+  * The cost of this action is a few comparisons per step when no cuts are set.
   */
 
 class nDetSteppingAction : public G4UserSteppingAction {
   public:
 	/** Constructor taking a pointer to a user run action
 	  */
-	nDetSteppingAction(nDetRunAction*);
+	nDetSteppingAction(nDetRunAction *run);
 
 	/** Destructor
 	  */
-	virtual ~nDetSteppingAction();
-
-	/** Perform processing on a particle step
-	  */
-	void UserSteppingAction(const G4Step*);
+	virtual ~nDetSteppingAction(){ }
 
-	/** Reset all class parameters
+	/** Kill optical photons which exceed the maximum global time, track length, or number of boundary reflections
+	  * and kill other particles which leave the detectors
 	  */
-	void Reset();
+	virtual void UserSteppingAction(const G4Step *step);
 
   private:
-	nDetRunAction* runAction; ///< Pointer to the thread-local user run action
+	nDetRunAction *runAction; ///< Pointer to the thread-local user run action
+	nDetConstruction *construction; ///< Pointer to the detector construction singleton (used for the cut values)
+
+	G4OpBoundaryProcess *boundary; ///< Pointer to the optical boundary process of the current thread (found on first use)
 
-	bool neutronTrack; ///< Flag indicating that a primary particle is being tracked
+	int numReflections; ///< Number of boundary reflections of the current optical photon track
+
+	/** Return true if the optical boundary process reflected the photon during the current step and return false otherwise
+	  */
+	bool isReflection(const G4Step *step);
 };
 
 #endif
-
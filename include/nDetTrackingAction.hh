@@ -22,9 +22,9 @@ class nDetTrackingAction: public G4UserTrackingAction {
 	~nDetTrackingAction(){ }
 
 	/** Action to perform before starting processing of a particle track
-	  * @note Currently does nothing
+	  * @note Records the initial kinetic energy of the primary particle
 	  */
-	void PreUserTrackingAction(const G4Track*){ }
+	void PreUserTrackingAction(const G4Track *track);
 
 	/** Action to perform after a particle track has been processed
 	  * @note Currently does nothing
@@ -74,6 +74,32 @@ class nDetWorld{
 	  */
 	bool setWorldFloor(const G4String &input);
 
+	/** Set the kill mode for particles leaving the detectors
+	  * @note In "auto" mode, non-optical particles in the world volume which are not heading towards any detector are killed if the
+	  *       world contains no material which could scatter them back (no floor, no objects, and an air or vacuum fill). Otherwise, 
+	  *       particles leaving the kill region are killed (if one is defined)
+	  * @param mode The kill mode ("off" or "auto")
+	  */
+	void setKillMode(const G4String &mode);
+
+	/** Set the size of the box centered on the world origin outside of which particles are killed along the X, Y, and Z axes (all in mm)
+	  * @note Only used in "auto" kill mode when the world contains scattering material. A size of zero disables the region
+	  */
+	void setKillRegion(const G4ThreeVector &size){ killRegionSize = size; }
+
+	/** Return true if the kill mode is "auto" and return false otherwise
+	  */
+	bool getKillModeAuto() const { return killModeAuto; }
+
+	/** Get the size of the kill region along the X, Y, and Z axes (all in mm)
+	  */
+	G4ThreeVector getKillRegion() const { return killRegionSize; }
+
+	/** Return true if the world contains a floor, user-defined objects, or a fill material other than air or vacuum, and return false otherwise
+	  * @note Only valid after the experimental hall has been built
+	  */
+	bool hasScatteringMaterial() const ;
+
 	/** Build the experiment hall physical and logical volumes
 	  */
 	void buildExpHall(nDetMaterials *materials);
@@ -121,6 +147,9 @@ class nDetWorld{
 
 	G4ThreeVector floorPitSize; ///< The size of the floor pit along the X, Y, and Z axes (all in mm)
 	G4ThreeVector hallSize; ///< Size of the experimental hall along the X, Y, and Z axes (all in mm)
+	G4ThreeVector killRegionSize; ///< Size of the box outside of which particles are killed along the X, Y, and Z axes (all in mm)
+
+	bool killModeAuto; ///< Flag indicating that particles leaving the detectors are killed automatically
 
 	std::vector<nDetWorldObject*> objects; ///< Vector of objects to add to the experimental setup area
 	
@@ -2,6 +2,8 @@
 #define PMT_RESPONSE_HH
 
 #include <vector>
+#include <string>
+#include <memory>
 
 /** @class spectralResponse
   * @brief Class used to interpolate PMT anode quantum efficiency from an input spectrum.
@@ -13,7 +15,7 @@ class spectralResponse{
   public:
 	/** Default constructor
 	  */
-	spectralResponse() : xmin(0), xmax(0), size(0) { }
+	spectralResponse() : xmin(0), xmax(0), size(0), tableStep(0) { }
 
 	/** Destructor
 	  */
@@ -41,6 +43,10 @@ class spectralResponse{
 	  */
 	size_t getSize() const { return size; }
 
+	/** Get the maximum quantum efficiency of the spectrum (in percent)
+	  */
+	double getMaximum() const ;
+
 	/** Copy the quantum efficiency spectrum from another spectralResponse object
 	  * @param other Pointer to another spectralResponse from which the spectrum will be copied
 	  */
@@ -53,6 +59,7 @@ class spectralResponse{
 	bool load(const std::string &fname);
 
 	/** Interpolate the quantum efficiency for a given wavelength
+	  * @note The spectrum is resampled onto a uniform grid when it is loaded, so this is a single table lookup regardless of the size of the spectrum
 	  * @param wavelength Optical photon wavelength (in nm)
 	  * @return Return the quantum efficiency for a given wavelength
 	  */
@@ -67,11 +74,62 @@ class spectralResponse{
 	std::vector<double> wavelength; ///< The vector of all wavelength values (in nm)
 	std::vector<double> percentage; ///< The vector of all quantum efficiencies (in percent)
 
+	std::vector<double> table; ///< Quantum efficiency resampled on a uniform wavelength grid starting at xmin (in percent)
+	double tableStep; ///< Wavelength step of the uniform grid (in nm)
+
+	/** Resample the spectrum onto the uniform wavelength grid. Called whenever the spectrum changes
+	  */
+	void buildTable();
+
 	/** Delete the spectrum and clear all values
 	  */	
 	void clear();
 };
 
+/** @class photonHitBuffer
+  * @brief Structure-of-arrays buffer of all optical photons detected by a single PMT
+  *
+  * All readout channels of a PMT (the dynode and the four Anger logic anodes of a segmented PMT) are built
+  * from the same buffer, so each detected photon is stored only once
+  */
+
+class photonHitBuffer{
+  public:
+	std::vector<double> time; ///< Optical photon arrival time (in ns)
+	std::vector<double> dt; ///< Offset of the single-photon-response due to the photo-electron transit time spread (in ns)
+	std::vector<double> wavelength; ///< Optical photon wavelength (in nm)
+	std::vector<short> pixel; ///< Index of the PMT anode which detected the photon (column*rows+row), or -1 for an unsegmented PMT
+	std::vector<double> gain; ///< Gain of the single photon response (anode gain times the statistical weight of the photon)
+
+	/** Get the number of detected photons
+	  */
+	size_t size() const { return time.size(); }
+
+	/** Return true if no photons have been detected and return false otherwise
+	  */
+	bool empty() const { return time.empty(); }
+
+	/** Add a detected photon to the buffer
+	  */
+	void add(const double &time_, const double &dt_, const double &wavelength_, const short &pixel_, const double &gain_){
+		time.push_back(time_);
+		dt.push_back(dt_);
+		wavelength.push_back(wavelength_);
+		pixel.push_back(pixel_);
+		gain.push_back(gain_);
+	}
+
+	/** Remove all photons from the buffer. Allocated memory is kept for the next event
+	  */
+	void clear(){
+		time.clear();
+		dt.clear();
+		wavelength.clear();
+		pixel.clear();
+		gain.clear();
+	}
+};
+
 /** @class pmtResponse
   * @brief Class used to simulate the light response due to detection of multiple optical photons.
   * @author Cory R. Thornsberry (cthornsb@vols.utk.edu)
@@ -80,29 +138,9 @@ class spectralResponse{
 
 class pmtResponse{
 public:
-	/** @class photonArrivalTime
-	  * @brief Simple structure to contain an optical photon's arrival time, its gain, and its time offset
-	  * @author Cory R. Thornsberry (cthornsb@vols.utk.edu)
-	  * @date September 19, 2019
-	  */
-	class photonArrivalTime{
-	public:
-		double time; ///< Optical photon arrival time (in ns)
-		double gain; ///< The gain of the single-photon response
-		double dt; ///< The offset of the response function due to PMT time spread (in ns)
-
-		/** Default constructor
-		  */
-		photonArrivalTime() : time(0), gain(1), dt(0) { }
-	
-		/** Arrival time constructor
-		  */
-		photonArrivalTime(const double &time_, const double &gain_, const double &dt_) : time(time_), gain(gain_), dt(dt_) { }
-	};
-
 	/** Types of single-photon light response functions
 	  */
-	enum photonResponseType {EXPO, VANDLE, GAUSS};
+	enum photonResponseType {EXPO, VANDLE, GAUSS, CUSTOM};
 
 	/** Default constructor
 	  */
@@ -118,7 +156,9 @@ public:
 	  */
 	~pmtResponse();
 
-	/** Clone this object
+	/** Clone the configuration of this object
+	  * @note The quantum efficiency spectrum and the tabulated single-photon-response are immutable and are shared with the clone. 
+	  *       Per-event data (photon arrival times and traces) are not copied
 	  */
 	pmtResponse clone() const ;
 
@@ -126,6 +166,11 @@ public:
 	  */
 	size_t getPulseLength() const { return pulseLength; }
 
+	/** Get the latest optical photon arrival time which may still contribute to the digitized pulse (in ns)
+	  * @note Includes the maximum ADC latching time (one half clock tick) and the maximum photo-electron transit time spread offset
+	  */
+	double getAcquisitionWindowEnd() const { return (pulseLength*adcClockTick - traceDelay + timeSpread/2); }
+
 	/** Get the maximum value of the pulse (in ADC channels)
 	  */
 	double getMaximum() const { return maximum; }
@@ -156,18 +201,45 @@ public:
 	bool getPulseIsSaturated() const { return pulseIsSaturated; }
 
 	/** Get the gain-weighted arrival time of the photon pulse (in ns)
+	  * @note Computed when the pulse is digitized
 	  */
-	double getWeightedPhotonArrivalTime() const ;
+	double getWeightedPhotonArrivalTime() const { return weightedArrivalTime; }
 
 	/** Get the total light response spectrum by sampling the single-photon response
 	  * spectra of each detected optical photon
+	  * @param hits The photons detected by the PMT
+	  * @param rawPulse Vector which will be filled with the raw light response pulse
 	  */
-	void getRawPulse(std::vector<double> &rawPulse) const ;
+	void getRawPulse(const photonHitBuffer &hits, std::vector<double> &rawPulse) const ;
 
 	/** Get the minimum photon arrival time of the pulse (in ns)
+	  * @note Computed when the pulse is digitized
 	  */
 	double getMinimumPhotonArrivalTime() const { return minimumArrivalTime; }
 
+	/** Get the index of the Anger logic anode readout of this channel, or -1 if this is a dynode readout
+	  */
+	short getAnodeIndex() const { return anodeIndex; }
+
+	/** Get the weight of a detected photon in this channel
+	  *
+	  * For a dynode readout, the weight is the gain of the photon times the quantum efficiency of the PMT (if enabled). For
+	  * an anode readout, the weight is the gain of the photon times the fraction of the current of its anode which flows
+	  * to this readout
+	  * @param hits The photons detected by the PMT
+	  * @param index The index of the photon in the buffer
+	  */
+	double getHitWeight(const photonHitBuffer &hits, const size_t &index) const ;
+
+	/** Sample a random offset due to the photo-electron transit time spread (in ns)
+	  */
+	double sampleTransitTimeOffset() const ;
+
+	/** Return true if another pmtResponse uses the same single photon response function, trace delay, and ADC sampling
+	  * as this one (i.e. both may be built from the same photons in a single pass) and return false otherwise
+	  */
+	bool sharesResponseWith(const pmtResponse &other) const ;
+
 	/** Return true if the digitized pulse is to be printed and return false otherwise
 	  */
 	bool getPrintTrace() const { return printTrace; }
@@ -184,13 +256,14 @@ public:
 	  */
 	bool getSpectralResponseEnabled() const { return useSpectralResponse; }
 
-	/** Get a pointer to the PMT quantum efficiency spectrum
+	/** Return true if the quantum efficiency has already been applied to detected photons by pre-culling, and return false otherwise
 	  */
-	spectralResponse* getSpectralResponse(){ return &spec; }
+	bool getQuantumEfficiencyAppliedAtBirth() const { return qeAppliedAtBirth; }
 
 	/** Get a const pointer to the PMT quantum efficiency spectrum
+	  * @return Pointer to the shared quantum efficiency spectrum or NULL if no spectrum has been loaded
 	  */
-	const spectralResponse* getConstSpectralResponse() const { return (const spectralResponse*)(&spec); }	
+	const spectralResponse* getConstSpectralResponse() const { return spec.get(); }
 
 	/** Set the rise time of the single photon pulse
 	  * @param risetime_ The rise time of the single photon response function (in ns)
@@ -240,10 +313,11 @@ public:
 	  * | EXPO (default) | [Double exponential function](https://iopscience.iop.org/article/10.1088/0031-9155/54/21/004) | Decay time of pulse (in ns) | Rise time of pulse (in ns) |
 	  * | VANDLE         | [Vandle function](https://www.sciencedirect.com/science/article/pii/S0168900213015672) | Gamma (in ns) | Beta (in ns) |
 	  * | GAUSS          | Normalized gaussian | Not used | Sigma (in ns) |
+	  * | CUSTOM         | Measured single photon response loaded by loadSinglePhotonResponse() | Not used | Not used |
 	  *
 	  * @param type The single photon response function to use
 	  */
-	void setFunctionType(const photonResponseType &type){ functionType = type; }
+	void setFunctionType(const photonResponseType &type);
 
 	/** Set the height of the digitized pulse baseline
 	  * @param percentage The amplitude of the pulse baseline (percentage of the total ADC dynamic range)
@@ -288,44 +362,84 @@ public:
 	  */
 	double setAdcLatchTicks(const double &latch){ return (tLatch = adcClockTick*latch); }
 
+	/** Get the ADC latching time (in ns)
+	  */
+	double getAdcLatchTime() const { return tLatch; }
+
+	/** Set the ADC latching time (in ns)
+	  */
+	void setAdcLatchTime(const double &latch){ tLatch = latch; }
+
+	/** Make this response an Anger logic anode readout of a segmented PMT
+	  * @param index The index of the readout [0, 4)
+	  * @param fractions Immutable table of the fraction of the current of each anode which flows to each of the four readouts (4 per anode)
+	  */
+	void setAnodeChannel(const short &index, const std::shared_ptr<const std::vector<double> > &fractions);
+
 	/** Disable use of PMT quantum efficiency spectrum
 	  */
 	void disableSpectralResponse(){ useSpectralResponse = false; }
 
+	/** Set whether or not the quantum efficiency has already been applied to detected photons by pre-culling
+	  * @note If set, detected photons are not weighted by the quantum efficiency when building the dynode pulse
+	  */
+	void setQuantumEfficiencyAppliedAtBirth(const bool &state){ qeAppliedAtBirth = state; }
+
 	/** Load PMT spectral response from root file
 	  * @param fname Path to a root file containing the anode quantum efficiency spectrum
 	  * @return True if the spectrum is loaded successfully and return false otherwise
 	  */
 	bool loadSpectralResponse(const char *fname);
 
-	/** Copy quantum efficiency spectrum from another pmtResponse object
-	  * @param spec_ Pointer to a spectralResponse from which the spectrum will be copied
+	/** Load a measured single photon response from a file and switch to the CUSTOM response function
+	  * 
+	  * The file may either be an ascii file containing two columns (time in ns and amplitude) or a root file containing
+	  * a TGraph named "spec". The response is resampled onto a uniform grid and normalized to unit integral so that the
+	  * gain of the pulse has the same meaning as for the built-in response functions
+	  * @param fname Path to the file containing the single photon response
+	  * @return True if the response is loaded successfully and return false otherwise
 	  */
-	void copySpectralResponse(const spectralResponse *spec_){ spec.copy(spec_); }
+	bool loadSinglePhotonResponse(const char *fname);
 
-	/** Add a photon signal to the raw pulse
-	  * @param arrival Arrival time of the optical photon (in ns)
-	  * @param wavelength Wavelength of the optical photon (in nm)
-	  * @param gain_ Additional multiplicitive gain to use for single photon response
+	/** Return true if a measured single photon response has been loaded (required by the CUSTOM response function) and return false otherwise
 	  */
-	void addPhoton(const double &arrival, const double &wavelength=0, const double &gain_=1);
+	bool hasSinglePhotonResponse() const { return (customKernel && !customKernel->empty()); }
 
-	/** Sample the total photon response by iterating over the list of single-photon arrival times
+	/** Share the quantum efficiency spectrum of another pmtResponse object
+	  * @note The spectrum is immutable, so only a reference to it is copied
+	  * @param other Pointer to a pmtResponse whose spectrum will be used by this object
+	  */
+	void copySpectralResponse(const pmtResponse *other){ spec = other->spec; }
+
+	/** Sample the total photon response by iterating over the list of detected photons
+	  * @param hits The photons detected by the PMT
 	  * @param time The time at which the full photon light response will be sampled (ns)
 	  * @return The full photon light response at the specified time
 	  */
-	double sample(const double &time) const ;
+	double sample(const photonHitBuffer &hits, const double &time) const ;
 
 	/** Build the raw light response pulse by stepping through the trace and sampling the sum of the 
 	  * response of all detected optical photons and then digitize the spectrum
+	  * @param hits The photons detected by the PMT
 	  * @param baseline The light pulse baseline as a fraction of the full ADC dynamic range
 	  * @param jitter The random jitter in the light pulse baseline as a fraction of the full ADC dynamic range
 	  */
-	void digitize(const double &baseline, const double &jitter);
+	void digitize(const photonHitBuffer &hits, const double &baseline, const double &jitter);
 
 	/** Digitize the raw light pulse (uses baseline=baselineFraction and jitter=baselineJitter)
+	  * @param hits The photons detected by the PMT
+	  */
+	void digitize(const photonHitBuffer &hits);
+
+	/** Digitize several readout channels of the same PMT (e.g. the dynode and the four anodes) from a single hit buffer
+	  *
+	  * Channels which share the response function of the first channel (see sharesResponseWith()) are built in a single
+	  * pass over the detected photons, all others are built separately. Channels which are already digitized are skipped
+	  * @param hits The photons detected by the PMT
+	  * @param channels Array of pointers to the readout channels
+	  * @param nChannels The number of readout channels
 	  */
-	void digitize();
+	static void digitize(const photonHitBuffer &hits, pmtResponse **channels, const size_t &nChannels);
 
 	/** Integrate the light pulse in a range and return the result
 	  * @param start_ Inclusive start index for integration (in ADC clock ticks)
@@ -441,18 +555,30 @@ private:
 	
 	bool isDigitized; ///< Flag indicating that the light response pulse has been digitized
 	bool useSpectralResponse; ///< Flag indicating that PMT anode quantum efficiency spectrum should be used to compute anode gain
+	bool qeAppliedAtBirth; ///< Flag indicating that the quantum efficiency was applied to optical photons at birth (pre-culling)
 	bool pulseIsSaturated; ///< Flag indicating that the digitized pulse has exceeded the maximum ADC dynamic range
 	bool printTrace; ///< Flag indicating that the left and right digitized PMT traces will be printed to the screen
 	
-	std::vector<unsigned short> pulseArray; ///< Array to store digitized light response pulse
+	std::vector<unsigned short> pulseArray; ///< Array to store digitized light response pulse (allocated by the first call to digitize())
+	std::vector<double> rawPulseArray; ///< Array to store the raw light response pulse sampled at each ADC clock tick
 
-	spectralResponse spec; ///< Anode quantum efficiency
+	std::shared_ptr<const spectralResponse> spec; ///< Anode quantum efficiency (shared by all copies of this object)
 
 	double minimumArrivalTime; ///< Minimum photon arrival time
+	double weightedArrivalTime; ///< Gain-weighted photon arrival time
+
+	short anodeIndex; ///< Index of the Anger logic anode readout of this channel, or -1 for a dynode readout
+	std::shared_ptr<const std::vector<double> > anodeFractions; ///< Fraction of the current of each anode which flows to each anode readout (shared by all copies of this object)
 
 	photonResponseType functionType; ///< Integer indicating the single photon response function to use to build the light response pulse
 
-	std::vector<photonArrivalTime> arrivalTimes; ///< Vector of all optical photon arrival times and their individual single-photon response gains
+	std::shared_ptr<const std::vector<double> > kernel; ///< Single-photon-response function tabulated on a uniform time grid, without gain (shared by all copies of this object)
+	double kernelStart; ///< Time of the first point of the tabulated single-photon-response (in ns)
+	double kernelStep; ///< Time step of the tabulated single-photon-response (in ns)
+
+	std::shared_ptr<const std::vector<double> > customKernel; ///< Measured single-photon-response on a uniform time grid, normalized to unit integral (shared by all copies of this object)
+	double customKernelStart; ///< Time of the first point of the measured single-photon-response (in ns)
+	double customKernelStep; ///< Time step of the measured single-photon-response (in ns)
 	
 	/** Evaluate the single-photon-response function for a given time and time offset
 	  * @param t The time to along the pulse at which to evaluate the single-photon-response function (in ns)
@@ -460,6 +586,64 @@ private:
 	  * @return The value of the single-photon-response function at the user specified time
 	  */
 	double func(const double &t, const double &dt=0) const ;
+
+	/** Interpolate the tabulated single-photon-response function (without gain)
+	  * @param tau The time since the arrival of the photon (in ns)
+	  * @return The linearly interpolated value of the table at @a tau, or zero if @a tau is outside the table
+	  */
+	double evalKernel(const double &tau) const ;
+
+	/** Tabulate the single-photon-response function. Called whenever the rise time, fall time, or function type changes
+	  *
+	  * The GAUSS response is tabulated within +/- 10 sigma and the leading edge of the VANDLE response is tabulated up to
+	  * the point where it becomes a pure exponential. The EXPO response and the tail of the VANDLE response are computed
+	  * recursively and do not use the table. The CUSTOM response uses the table loaded by loadSinglePhotonResponse()
+	  */
+	void updateKernel();
+
+	/** Get the index of the first ADC sample which occurs after a single-photon-response time offset
+	  * @param dt The offset of the pulse along the time axis (in ns)
+	  * @param index The index of the first ADC sample for which the time is strictly greater than @a dt
+	  * @return True if the sample is inside the trace and return false otherwise
+	  */
+	bool getFirstSample(const double &dt, size_t &index) const ;
+
+	/** Get the offset of the single-photon-response of a detected photon due to the trace delay and the transit time spread (in ns)
+	  */
+	double getResponseOffset(const photonHitBuffer &hits, const size_t &index) const ;
+
+	/** Build the raw light response pulse at each ADC clock tick from the list of detected photons
+	  * 
+	  * Instead of evaluating the full single-photon-response of every photon at every ADC sample, each photon
+	  * is assigned to the first ADC sample following its arrival. For the EXPO response, both exponential terms
+	  * are then propagated from one sample to the next recursively (a first order IIR filter) so that the cost
+	  * is O(photons + samples). The leading edge of the VANDLE response is interpolated from the tabulated kernel
+	  * and its purely exponential tail is propagated recursively. The GAUSS and CUSTOM responses are interpolated
+	  * from the tabulated kernel over its finite extent. The EXPO result is equal to sample() evaluated at each ADC
+	  * clock tick to within double precision, the others to within the interpolation error of the kernel
+	  * @param hits The photons detected by the PMT
+	  * @param pulse Vector which will be filled with the raw light response pulse (pulseLength samples)
+	  */
+	void synthesize(const photonHitBuffer &hits, std::vector<double> &pulse) const ;
+
+	/** Build the raw light response pulses of several channels in a single pass over the detected photons
+	  *
+	  * The single-photon-response of each photon (see synthesize()) is computed only once and added to every channel with
+	  * the weight of the photon in that channel. The response function, trace delay, and ADC sampling of the first channel
+	  * are used for all channels, so all channels must share it (see sharesResponseWith())
+	  * @param hits The photons detected by the PMT
+	  * @param channels Array of pointers to the readout channels
+	  * @param pulses Array of pointers to the vectors which will be filled with the raw pulse of each channel
+	  * @param nChannels The number of readout channels
+	  */
+	static void synthesize(const photonHitBuffer &hits, const pmtResponse * const *channels, std::vector<double> * const *pulses, const size_t &nChannels);
+
+	/** Digitize the raw light response pulse and compute the photon arrival times of this channel
+	  * @param hits The photons detected by the PMT
+	  * @param baseline The light pulse baseline as a fraction of the full ADC dynamic range
+	  * @param jitter The random jitter in the light pulse baseline as a fraction of the full ADC dynamic range
+	  */
+	void digitizeRawPulse(const photonHitBuffer &hits, const double &baseline, const double &jitter);
 	
 	/** Compute the baseline and maximum of the light pulse
 	  * @return The maximum of the light pulse if the array is properly initialized and return -9999 otherwise
@@ -18,11 +18,22 @@ centerOfMass::~centerOfMass(){
 
 centerOfMass centerOfMass::clone() const {
 	centerOfMass retval;
+	retval.Ncol = Ncol;
+	retval.Nrow = Nrow;
+	retval.activeWidth = activeWidth;
+	retval.activeHeight = activeHeight;
+	retval.pixelWidth = pixelWidth;
+	retval.pixelHeight = pixelHeight;
 	retval.response = response.clone();
-	for(size_t i = 0; i < 4; i++)
-		retval.anodeResponse[i] = anodeResponse[i].clone();
+	
+	// The anode readouts use the same digitizer settings as the dynode
+	retval.anodeFractions = anodeFractions;
+	for(size_t i = 0; i < 4; i++){
+		retval.anodeResponse[i] = response.clone();
+		retval.anodeResponse[i].setAnodeChannel(i, anodeFractions);
+	}
 	retval.gainMatrix = gainMatrix;
-	retval.countMatrix = countMatrix;
+	retval.countMatrix.assign(countMatrix.size(), std::vector<int>(countMatrix.empty() ? 0 : countMatrix.front().size(), 0));
 	return retval;
 }
 
@@ -61,6 +72,13 @@ bool centerOfMass::getCenterSegment(short &col, short &row) const {
 	return this->getCenterSegment(pos, col, row);
 }	
 
+void centerOfMass::getGainMatrix(std::vector<std::vector<double> > &matrix) const {
+	if(gainMatrix)
+		matrix = *gainMatrix;
+	else
+		matrix.clear();
+}
+
 void centerOfMass::getAnodeCurrents(double *array) const {
 	for(size_t i = 0; i < 4; i++){
 		array[i] = anodeCurrent[i];
@@ -111,12 +129,23 @@ void centerOfMass::setSegmentedPmt(const nDetDetectorParams *params){
 	pixelHeight = activeHeight / Nrow;
 	
 	// Setup the anode gain matrix.
-	gainMatrix.clear();
-	countMatrix.clear();
-	for(short i = 0; i < Ncol; i++){
-		gainMatrix.push_back(std::vector<double>(Nrow, 100));
-		countMatrix.push_back(std::vector<int>(Nrow, 0));
+	gainMatrix.reset(new std::vector<std::vector<double> >(Ncol, std::vector<double>(Nrow, 100)));
+	countMatrix.assign(Ncol, std::vector<int>(Nrow, 0));
+
+	// Tabulate the fraction of the current of each anode which flows to each Anger logic readout.
+	std::vector<double> *fractions = new std::vector<double>(4*Ncol*Nrow, 0);
+	for(short col = 0; col < Ncol; col++){
+		for(short row = 0; row < Nrow; row++){
+			double *current = getCurrent(col, row);
+			if(!current) continue;
+			double totalCurrent = current[0] + current[1] + current[2] + current[3];
+			for(size_t i = 0; i < 4; i++)
+				(*fractions)[4*(col*Nrow+row)+i] = current[i]/totalCurrent;
+		}
 	}
+	anodeFractions.reset(fractions);
+	for(size_t i = 0; i < 4; i++)
+		anodeResponse[i].setAnodeChannel(i, anodeFractions);
 }
 
 bool centerOfMass::loadSpectralResponse(const char *fname){
@@ -124,41 +153,37 @@ bool centerOfMass::loadSpectralResponse(const char *fname){
 }
 
 bool centerOfMass::loadGainMatrix(const char *fname){
-	if(gainMatrix.empty() || Ncol*Nrow == 0) return false;
+	if(!gainMatrix || Ncol*Nrow == 0) return false;
 	std::ifstream gainFile(fname);
 	if(!gainFile.good()) return false;
 	
+	// The shared matrix is immutable, so fill a new one
+	std::vector<std::vector<double> > *matrix = new std::vector<std::vector<double> >(*gainMatrix);
 	double readval;
 	for(short col = 0; col < Ncol; col++){
 		for(short row = 0; row < Nrow; row++){
 			gainFile >> readval;
 			if(gainFile.eof()){
 				gainFile.close();
+				delete matrix;
 				return false;
 			}
-			gainMatrix[col][row] = readval;
+			(*matrix)[col][row] = readval;
 		}
 	}
 	
 	gainFile.close();
+	gainMatrix.reset(matrix);
 	
 	return true;
 }
 
-void centerOfMass::copySpectralResponse(centerOfMass *other){
-	response.copySpectralResponse(other->getPmtResponse()->getSpectralResponse());
-}
-
 void centerOfMass::copySpectralResponse(const centerOfMass *other){
-	response.copySpectralResponse(other->getConstPmtResponse()->getConstSpectralResponse());
-}
-
-void centerOfMass::copyGainMatrix(centerOfMass *other){
-	other->getGainMatrix(gainMatrix);
+	response.copySpectralResponse(other->getConstPmtResponse());
 }
 
 void centerOfMass::copyGainMatrix(const centerOfMass *other){
-	other->getGainMatrix(gainMatrix);
+	gainMatrix = other->gainMatrix;
 }
 
 void centerOfMass::clear(){
@@ -167,8 +192,10 @@ void centerOfMass::clear(){
 	tSum = 0;
 	lambdaSum = 0;
 	totalMass = 0;
+	totalWeight = 0;
 	center = G4ThreeVector();
 	t0 = std::numeric_limits<double>::max();	
+	hits.clear();
 	response.clear();
 	for(size_t i = 0; i < 4; i++){
 		anodeCurrent[i] = 0;
@@ -186,8 +213,8 @@ bool centerOfMass::addPoint(const double &energy, const double &time, const G4Th
 	if(Ncol < 0 && Nrow < 0){ // Default behavior
 		center += mass*position;	
 		
-		// Add the PMT response to the "digitized" trace
-		response.addPhoton(time, wavelength);
+		// Add the photon to the hit buffer of the PMT
+		hits.add(time, response.sampleTransitTimeOffset(), wavelength, -1, mass);
 		
 		// Add the "mass" to the others
 		totalMass += mass;		
@@ -202,16 +229,10 @@ bool centerOfMass::addPoint(const double &energy, const double &time, const G4Th
 			increment(xpos, ypos);
 
 			// Add the anger logic currents to the anode outputs.
-			double totalCurrent = 0;
 			double *current = getCurrent(xpos, ypos);
 			if(current){
-				for(size_t i = 0; i < 4; i++){
+				for(size_t i = 0; i < 4; i++)
 					anodeCurrent[i] += gain*mass*current[i];
-					totalCurrent += current[i];
-				}
-				for(size_t i = 0; i < 4; i++){
-					anodeResponse[i].addPhoton(time, 0, gain*mass*(current[i]/totalCurrent));
-				}
 			}
 			
 			// Compute resistor network leakage current. This is unnecessary for symmetric leakage... CRT
@@ -229,11 +250,11 @@ bool centerOfMass::addPoint(const double &energy, const double &time, const G4Th
 				}
 			}*/
 			
-			// Add the PMT response to the "digitized" trace
-			response.addPhoton(time, wavelength, gain);
+			// Add the photon to the hit buffer of the PMT. The dynode and the anode traces are both built from it
+			hits.add(time, response.sampleTransitTimeOffset(), wavelength, xpos*Nrow+ypos, gain*mass);
 
 			// Add the "mass" to the others weighted by the individual anode gain
-			center += pos;
+			center += mass*pos;
 			totalMass += mass;
 		}
 	}
@@ -242,11 +263,25 @@ bool centerOfMass::addPoint(const double &energy, const double &time, const G4Th
 	lambdaSum += wavelength;
 	if(time < t0) t0 = time;
 
+	totalWeight += mass;
 	Npts++;
 	
 	return true;
 }
 
+void centerOfMass::digitize(){
+	pmtResponse *channels[5] = {&response, &anodeResponse[0], &anodeResponse[1], &anodeResponse[2], &anodeResponse[3]};
+	if(!anodeFractions){ // Unsegmented PMT, only the dynode is read out
+		pmtResponse::digitize(hits, channels, 1);
+		return;
+	}
+	
+	// The anodes are latched at the same time as the dynode
+	for(size_t i = 0; i < 4; i++)
+		anodeResponse[i].setAdcLatchTime(response.getAdcLatchTime());
+	pmtResponse::digitize(hits, channels, 5);
+}
+
 void centerOfMass::printCounts() const {
 	for(short i = Nrow-1; i >= 0; i--){
 		for(short j = 0; j < Ncol; j++){
@@ -269,8 +304,8 @@ void centerOfMass::increment(const int &x, const int &y){
 }
 
 double centerOfMass::getGain(const int &x, const int &y){
-	if((x < 0 || x >= Ncol) || (y < 0 || y >= Nrow) || gainMatrix.empty()) return 0;
-	return gainMatrix[x][y]/100;
+	if((x < 0 || x >= Ncol) || (y < 0 || y >= Nrow) || !gainMatrix) return 0;
+	return (*gainMatrix)[x][y]/100;
 }
 
 double *centerOfMass::getCurrent(const int &x, const int &y){
@@ -10,19 +10,19 @@
 #include "nDetRunAction.hh"
 #include "nDetEventAction.hh"
 #include "nDetStackingAction.hh"
-#include "nDetSteppingAction.hh"
 #include "nDetTrackingAction.hh"
+#include "nDetSteppingAction.hh"
 #include "nDetThreadContainer.hh"
 
-userActionManager::userActionManager(const nDetActionInitialization* init, bool verboseMode/*=false*/) : threadID(0), runAction(NULL), eventAction(NULL), steppingAction(NULL), stackingAction(NULL), trackingAction(NULL), actionInit(init) {
+userActionManager::userActionManager(const nDetActionInitialization* init, bool verboseMode/*=false*/) : threadID(0), runAction(NULL), eventAction(NULL), stackingAction(NULL), trackingAction(NULL), steppingAction(NULL), actionInit(init) {
 	threadID = G4Threading::G4GetThreadId();
 
 	// Define all user actions.
 	runAction = new nDetRunAction();
 	eventAction = new nDetEventAction(runAction);
-	steppingAction = new nDetSteppingAction(runAction);
 	stackingAction = new nDetStackingAction(runAction);
 	trackingAction = new nDetTrackingAction(runAction);
+	steppingAction = new nDetSteppingAction(runAction);
 	
 	// Set verbose mode
 	if(verboseMode) runAction->toggleVerboseMode();
@@ -37,13 +37,17 @@ nDetActionInitialization::nDetActionInitialization(bool verboseMode/*=false*/) :
 void nDetActionInitialization::Build() const {
 	userActionManager manager(this, verbose);
 
+	// Create the primary generator first so that the run action uses the same (thread-local) source
+	nDetPrimaryGeneratorAction *generator = new nDetPrimaryGeneratorAction();
+	manager.getRunAction()->setParticleSource(generator->getParticleSource());
+
 	// Set pointers to all user actions
 	SetUserAction(manager.getRunAction());
 	SetUserAction(manager.getEventAction());
-	SetUserAction(manager.getSteppingAction());
 	SetUserAction(manager.getStackingAction());
 	SetUserAction(manager.getTrackingAction());
-	SetUserAction(new nDetPrimaryGeneratorAction());
+	SetUserAction(manager.getSteppingAction());
+	SetUserAction(generator);
 
 	// Add this thread to the list of all threads
 	nDetThreadContainer::getInstance().addAction(manager);
@@ -1,3 +1,15 @@
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdio.h>
+
 #include "G4LogicalVolume.hh"
 #include "G4LogicalSkinSurface.hh"
 #include "G4LogicalBorderSurface.hh"
@@ -11,16 +23,28 @@
 
 #include "G4GeometryManager.hh"
 #include "G4RunManager.hh"
+#include "G4SDManager.hh"
+#include "G4Region.hh"
+#include "G4RegionStore.hh"
+#include "G4ProductionCuts.hh"
+#include "G4ProductionCutsTable.hh"
+#include "G4VUserPhysicsList.hh"
+#include "G4Material.hh"
+#include "G4SystemOfUnits.hh"
 #include "G4VisAttributes.hh"
 
 #include "G4PVPlacement.hh"
 #include "G4ThreeVector.hh"
 
+#include "TFile.h"
+
 #include "nDetConstruction.hh"
 #include "nDetConstructionMessenger.hh"
 #include "nDetThreadContainer.hh"
 #include "nDetParticleSource.hh"
 #include "nDetWorld.hh"
+#include "nDetSensitiveDetector.hh"
+#include "nDetFastNeutronElastic.hh"
 #include "termColors.hh"
 #include "optionHandler.hh" // split_str
 
@@ -51,9 +75,52 @@ nDetConstruction::nDetConstruction(){
 	
 	// Setup the experimental setup area
 	expHall = new nDetWorld();
+
+	// Light maps are disabled by default
+	lightMapMode = nDetLightMap::OFF;
+
+	// Track all optical photons by default
+	photonSurvivalProb = 1;
+
+	// Optical photon cuts are disabled by default
+	photonTimeCutAuto = false;
+	photonTimeCut = 0;
+	photonMaxTime = 0;
+	photonMaxTrackLength = 0;
+	photonMaxReflections = 0;
+
+	// Particles leaving the detectors are not killed by default
+	killMode = KILL_OFF;
+
+	// Regions are defined when the geometry is built. Secondaries in the floor and world objects are produced with a coarse cut
+	scintRegion = NULL;
+	detectorRegion = NULL;
+	worldRegion = NULL;
+	scintCut = 0;
+	detectorCut = 0;
+	worldCut = 10*mm;
+
+	// Optical photons are only tracked inside of the detectors
+	trackPhotonsOutside = false;
+
+	// The physics table cache is disabled by default
+	physicsList = NULL;
+	physicsListName = "unknown";
+	physicsCacheRetrieved = false;
+
+	// Track optical photons along with all other particles by default
+	deferOpticalPhotons = false;
+	opticalTriggerThreshold = 0;
+
+	// Quantum efficiency pre-culling is disabled by default
+	qeCulling = QE_CULL_OFF;
+	qeCullingActive = QE_CULL_OFF;
+	qeCullingSpectrum = NULL;
+	qeCullingMaximum = 1;
 }
 
 nDetConstruction::~nDetConstruction(){
+	clearLightMaps();
 }
 
 G4VPhysicalVolume* nDetConstruction::Construct(){
@@ -81,9 +148,52 @@ G4VPhysicalVolume* nDetConstruction::ConstructDetector(){
 		det->placeDetector(expHall->getLogicalVolume());
 	}
 
+	// Classify all physical volumes for fast lookup during tracking
+	classifyVolumes();
+
+	// Define the regions used for production cuts and optical photon transport
+	defineRegions();
+
+	// Retrieve the physics tables for these materials and production cuts (if available)
+	PreparePhysicsCache();
+
 	return expHall->getPhysicalVolume();
 }
 
+void nDetConstruction::ConstructSDandField(){
+	// Sensitive detectors are thread-local and may only be registered once per thread
+	static G4ThreadLocal nDetPmtSensitiveDetector *pmtSD = NULL;
+	static G4ThreadLocal nDetScintSensitiveDetector *scintSD = NULL;
+	if(!pmtSD){
+		pmtSD = new nDetPmtSensitiveDetector("nDetPmtSD");
+		G4SDManager::GetSDMpointer()->AddNewDetector(pmtSD);
+	}
+	if(!scintSD){
+		scintSD = new nDetScintSensitiveDetector("nDetScintSD");
+		G4SDManager::GetSDMpointer()->AddNewDetector(scintSD);
+	}
+
+	// Many physical volumes share the same logical volume, attach each logical volume only once
+	std::set<G4LogicalVolume*> attached;
+	G4PhysicalVolumeStore *store = G4PhysicalVolumeStore::GetInstance();
+	for(std::vector<G4VPhysicalVolume*>::iterator iter = store->begin(); iter != store->end(); iter++){
+		G4VSensitiveDetector *sd = NULL;
+		switch(GetVolumeRole(*iter)){
+			case SENSITIVE:
+				sd = pmtSD;
+				break;
+			case SCINTILLATOR:
+				sd = scintSD;
+				break;
+			default:
+				continue;
+		}
+		G4LogicalVolume *logV = (*iter)->GetLogicalVolume();
+		if(attached.insert(logV).second)
+			SetSensitiveDetector(logV, sd);
+	}
+}
+
 void nDetConstruction::ClearGeometry(){
 	// Clean-up previous geometry
     G4GeometryManager::GetInstance()->OpenGeometry();
@@ -271,6 +381,208 @@ void nDetConstruction::SetLightYieldMultiplier(const G4double &yield){
 	materials.setLightYield(yield);
 }
 
+void nDetConstruction::SetPhotonSurvivalProbability(const G4double &prob){
+	if(prob <= 0 || prob > 1){
+		Display::ErrorPrint("Optical photon survival probability must be in the range (0, 1]!", "nDetConstruction");
+		return;
+	}
+	photonSurvivalProb = prob;
+}
+
+void nDetConstruction::SetPhotonTimeCut(const G4String &input){
+	if(input == "off"){
+		photonTimeCutAuto = false;
+		photonTimeCut = 0;
+	}
+	else if(input == "auto"){
+		photonTimeCutAuto = true;
+		photonTimeCut = 0;
+	}
+	else{
+		double time = strtod(input.c_str(), NULL);
+		if(time <= 0){
+			Display::ErrorPrint("Optical photon time cut must be \"off\", \"auto\", or a time greater than zero!", "nDetConstruction");
+			return;
+		}
+		photonTimeCutAuto = false;
+		photonTimeCut = time;
+	}
+}
+
+void nDetConstruction::SetPhotonMaxTrackLength(const G4double &length){
+	if(length < 0){
+		Display::ErrorPrint("Optical photon maximum track length must not be negative!", "nDetConstruction");
+		return;
+	}
+	photonMaxTrackLength = length;
+}
+
+void nDetConstruction::SetPhotonMaxReflections(const G4int &count){
+	if(count < 0){
+		Display::ErrorPrint("Optical photon maximum number of reflections must not be negative!", "nDetConstruction");
+		return;
+	}
+	photonMaxReflections = count;
+}
+
+bool nDetConstruction::InitializePhotonCuts(){
+	photonMaxTime = photonTimeCut;
+	if(photonTimeCutAuto){ // Use the latest end of the acquisition windows of all PMTs
+		photonMaxTime = 0;
+		for(auto det : userDetectors){
+			photonMaxTime = std::max(photonMaxTime, det->getPmtResponseL()->getAcquisitionWindowEnd());
+			photonMaxTime = std::max(photonMaxTime, det->getPmtResponseR()->getAcquisitionWindowEnd());
+		}
+		std::cout << " nDetConstruction: Setting optical photon time cut to " << photonMaxTime << " ns\n";
+	}
+	return (photonMaxTime > 0);
+}
+
+bool nDetConstruction::InitializeKillMode(){
+	killMode = KILL_OFF;
+	envelopeSolids.clear();
+	envelopePositions.clear();
+	envelopeRotations.clear();
+	
+	if(!expHall->getKillModeAuto() || userDetectors.empty())
+		return false;
+	
+	if(expHall->hasScatteringMaterial()){ // Particles may scatter back into the detectors, use the kill region instead
+		G4ThreeVector size = expHall->getKillRegion();
+		if(size.getX() <= 0 || size.getY() <= 0 || size.getZ() <= 0){
+			Display::WarningPrint("World contains scattering material and no kill region is defined, particles will not be killed", "nDetConstruction");
+			return false;
+		}
+		killRegionHalfSize = size/2;
+		killMode = KILL_REGION;
+		return true;
+	}
+	
+	// Copy the placement of each detector assembly
+	for(auto det : userDetectors){
+		if(!det->getLogicalVolume()){
+			Display::WarningPrint("Detector assembly has not been built, particles will not be killed", "nDetConstruction");
+			envelopeSolids.clear();
+			envelopePositions.clear();
+			envelopeRotations.clear();
+			return false;
+		}
+		envelopeSolids.push_back(det->getLogicalVolume()->GetSolid());
+		envelopePositions.push_back(*det->getPosition());
+		envelopeRotations.push_back(*det->getRotation());
+	}
+	killMode = KILL_ENVELOPE;
+	return true;
+}
+
+bool nDetConstruction::CheckKillParticle(const G4ThreeVector &position, const G4ThreeVector &direction) const {
+	if(killMode == KILL_REGION){
+		return (std::fabs(position.getX()) > killRegionHalfSize.getX() || std::fabs(position.getY()) > killRegionHalfSize.getY() || 
+		        std::fabs(position.getZ()) > killRegionHalfSize.getZ());
+	}
+	else if(killMode == KILL_ENVELOPE){
+		// Particles travel in straight lines through the world, so a particle may only reach a detector if its
+		// path intersects the assembly volume of the detector
+		for(size_t index = 0; index < envelopeSolids.size(); index++){
+			G4ThreeVector localPosition = envelopeRotations[index]*(position - envelopePositions[index]);
+			G4ThreeVector localDirection = envelopeRotations[index]*direction;
+			if(envelopeSolids[index]->DistanceToIn(localPosition, localDirection) != kInfinity) // Heading towards the detector
+				return false;
+		}
+		return true;
+	}
+	return false;
+}
+
+void nDetConstruction::SetOpticalTriggerThreshold(const G4double &threshold){
+	if(threshold < 0){
+		Display::ErrorPrint("Optical photon trigger threshold must not be negative!", "nDetConstruction");
+		return;
+	}
+	opticalTriggerThreshold = threshold;
+}
+
+void nDetConstruction::SetQuantumEfficiencyCulling(const G4String &mode){
+	if(mode == "off")
+		qeCulling = QE_CULL_OFF;
+	else if(mode == "max")
+		qeCulling = QE_CULL_MAXIMUM;
+	else if(mode == "wavelength")
+		qeCulling = QE_CULL_WAVELENGTH;
+	else
+		Display::ErrorPrint("Unrecognized quantum efficiency culling mode. Expected \"off\", \"max\", or \"wavelength\".", "nDetConstruction");
+}
+
+std::string nDetConstruction::GetQuantumEfficiencyCullingString() const {
+	switch(qeCullingActive){
+		case QE_CULL_MAXIMUM:
+			return "max";
+		case QE_CULL_WAVELENGTH:
+			return "wavelength";
+		default:
+			break;
+	}
+	return "off";
+}
+
+bool nDetConstruction::InitializeQuantumEfficiencyCulling(){
+	qeCullingActive = QE_CULL_OFF;
+	qeCullingSpectrum = NULL;
+	qeCullingMaximum = 1;
+
+	if(qeCulling == QE_CULL_OFF || userDetectors.empty())
+		return false;
+
+	if(lightMapMode == nDetLightMap::BUILD){ // Light maps must not include the quantum efficiency
+		Display::WarningPrint("Quantum efficiency culling is not supported while building light maps!", "nDetConstruction");
+		return false;
+	}
+
+	// Find the maximum quantum efficiency of all PMTs
+	bool sharedSpectrum = true;
+	const spectralResponse *firstSpec = userDetectors.front()->getPmtResponseL()->getConstSpectralResponse();
+	double maximum = 0;
+	for(auto det : userDetectors){
+		for(int side = 0; side < 2; side++){
+			const pmtResponse *pmt = (side == 0 ? det->getPmtResponseL() : det->getPmtResponseR());
+			const spectralResponse *spec = pmt->getConstSpectralResponse();
+			if(!pmt->getSpectralResponseEnabled() || !spec){
+				Display::WarningPrint("Quantum efficiency culling requires a quantum efficiency spectrum for all PMTs!", "nDetConstruction");
+				return false;
+			}
+			if(spec != firstSpec)
+				sharedSpectrum = false;
+			maximum = std::max(maximum, spec->getMaximum()/100);
+		}
+	}
+	
+	if(maximum <= 0){
+		Display::WarningPrint("Maximum PMT quantum efficiency is zero, disabling quantum efficiency culling", "nDetConstruction");
+		return false;
+	}
+	qeCullingMaximum = std::min(maximum, 1.0);
+	
+	if(qeCulling == QE_CULL_WAVELENGTH){
+		if(sharedSpectrum){
+			qeCullingSpectrum = firstSpec;
+			qeCullingActive = QE_CULL_WAVELENGTH;
+			return true;
+		}
+		Display::WarningPrint("PMT quantum efficiency spectra differ, using maximum quantum efficiency culling", "nDetConstruction");
+	}
+	
+	qeCullingActive = QE_CULL_MAXIMUM;
+	return true;
+}
+
+G4double nDetConstruction::GetQuantumEfficiencySurvivalProbability(const G4double &wavelength) const {
+	if(qeCullingActive == QE_CULL_WAVELENGTH)
+		return qeCullingSpectrum->eval(wavelength)/100;
+	else if(qeCullingActive == QE_CULL_MAXIMUM)
+		return qeCullingMaximum;
+	return 1;
+}
+
 void nDetConstruction::PrintAllDetectors() const {
 	int detCount = 0;
 	for(auto det : userDetectors){
@@ -285,3 +597,443 @@ void nDetConstruction::GetCopiesOfDetectors(std::vector<nDetDetector> &detectors
 	for(auto det : userDetectors)
 		detectors.push_back(det->clone());
 }
+
+void nDetConstruction::BuildLightMap(const std::string &fname){
+	clearLightMaps();
+	lightMapFilename = fname;
+	lightMapMode = nDetLightMap::BUILD;
+	std::cout << " nDetConstruction: Light maps will be built and written to \"" << fname << "\" at the end of each run\n";
+}
+
+bool nDetConstruction::LoadLightMap(const std::string &fname){
+	clearLightMaps();
+	lightMapMode = nDetLightMap::OFF;
+
+	TFile *f = new TFile(fname.c_str(), "READ");
+	if(!f->IsOpen()){
+		Display::ErrorPrint("Failed to open light map file \""+fname+"\"!", "nDetConstruction");
+		delete f;
+		return false;
+	}
+
+	// Read one light map for each detector
+	for(size_t index = 0; ; index++){
+		std::stringstream stream;
+		stream << "map" << index;
+		if(!f->Get(stream.str().c_str()))
+			break;
+		nDetLightMap *map = new nDetLightMap();
+		if(!map->read(f, stream.str())){
+			delete map;
+			clearLightMaps();
+			break;
+		}
+		lightMaps.push_back(map);
+	}
+
+	f->Close();
+	delete f;
+
+	if(lightMaps.empty()){
+		Display::ErrorPrint("Failed to load light maps from file!", "nDetConstruction");
+		return false;
+	}
+
+	std::cout << " nDetConstruction: Successfully loaded " << lightMaps.size() << " light map(s) from \"" << fname << "\"\n";
+	lightMapMode = nDetLightMap::FAST;
+
+	return true;
+}
+
+void nDetConstruction::SetLightMapVoxels(const G4String &input){
+	std::vector<std::string> args;
+	unsigned int Nargs = split_str(input, args);
+	if(Nargs < 3){
+		std::cout << " nDetConstruction: Invalid number of arguments given to ::SetLightMapVoxels(). Expected 3, received " << Nargs << ".\n";
+		std::cout << " nDetConstruction:  SYNTAX: setVoxels <nx> <ny> <nz>\n";
+		return;
+	}
+	lightMapBinning.setNumVoxels(strtol(args.at(0).c_str(), NULL, 10), strtol(args.at(1).c_str(), NULL, 10), strtol(args.at(2).c_str(), NULL, 10));
+}
+
+void nDetConstruction::SetLightMapTimeBins(const G4String &input){
+	std::vector<std::string> args;
+	unsigned int Nargs = split_str(input, args);
+	if(Nargs < 1){
+		std::cout << " nDetConstruction: Invalid number of arguments given to ::SetLightMapTimeBins(). Expected 1, received " << Nargs << ".\n";
+		std::cout << " nDetConstruction:  SYNTAX: setTimeBins <nbins> [tmax]\n";
+		return;
+	}
+	lightMapBinning.setTimeBins(strtol(args.at(0).c_str(), NULL, 10), (Nargs >= 2 ? strtod(args.at(1).c_str(), NULL) : 50));
+}
+
+void nDetConstruction::SetLightMapPositionBins(const G4String &input){
+	std::vector<std::string> args;
+	unsigned int Nargs = split_str(input, args);
+	if(Nargs < 1){
+		std::cout << " nDetConstruction: Invalid number of arguments given to ::SetLightMapPositionBins(). Expected 1, received " << Nargs << ".\n";
+		std::cout << " nDetConstruction:  SYNTAX: setPositionBins <nx> [ny]\n";
+		return;
+	}
+	short nx = strtol(args.at(0).c_str(), NULL, 10);
+	lightMapBinning.setPositionBins(nx, (Nargs >= 2 ? strtol(args.at(1).c_str(), NULL, 10) : nx));
+}
+
+bool nDetConstruction::InitializeLightMaps(){
+	if(lightMapMode == nDetLightMap::OFF)
+		return false;
+
+	if(lightMapMode == nDetLightMap::FAST){ // Check that the loaded maps match the detector setup
+		if(lightMaps.size() != userDetectors.size()){
+			Display::ErrorPrint("Number of loaded light maps does not match the number of detectors! Disabling fast light map simulation.", "nDetConstruction");
+			lightMapMode = nDetLightMap::OFF;
+			return false;
+		}
+		for(size_t index = 0; index < userDetectors.size(); index++){
+			if(!lightMaps.at(index)->checkSize(userDetectors.at(index)->GetMaxBodySize())){
+				Display::ErrorPrint("Light map size does not match the size of the detector body! Disabling fast light map simulation.", "nDetConstruction");
+				lightMapMode = nDetLightMap::OFF;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Check whether the existing maps may be re-used
+	bool rebuild = (lightMaps.size() != userDetectors.size());
+	for(size_t index = 0; !rebuild && index < userDetectors.size(); index++){
+		if(!lightMaps.at(index)->checkSize(userDetectors.at(index)->GetMaxBodySize()))
+			rebuild = true;
+	}
+	if(!rebuild) // Continue accumulating into the existing maps
+		return true;
+
+	// Create new, empty light maps for all detectors
+	clearLightMaps();
+	for(auto det : userDetectors){
+		G4ThreeVector bodySize = det->GetMaxBodySize();
+		nDetLightMap *map = new nDetLightMap();
+		map->copyBinning(lightMapBinning);
+		if(!map->initialize(bodySize, std::max(bodySize.getX(), det->GetPmtWidth()), std::max(bodySize.getY(), det->GetPmtHeight()))){
+			delete map;
+			clearLightMaps();
+			lightMapMode = nDetLightMap::OFF;
+			return false;
+		}
+		lightMaps.push_back(map);
+	}
+
+	return true;
+}
+
+bool nDetConstruction::WriteLightMaps(){
+	if(lightMapMode != nDetLightMap::BUILD || lightMaps.empty())
+		return false;
+
+	TFile *f = new TFile(lightMapFilename.c_str(), "RECREATE");
+	if(!f->IsOpen()){
+		Display::ErrorPrint("Failed to open output light map file \""+lightMapFilename+"\"!", "nDetConstruction");
+		delete f;
+		return false;
+	}
+
+	bool retval = true;
+	for(size_t index = 0; index < lightMaps.size(); index++){
+		std::stringstream stream;
+		stream << "map" << index;
+		if(!lightMaps.at(index)->write(f, stream.str()))
+			retval = false;
+	}
+
+	f->Close();
+	delete f;
+
+	if(retval)
+		std::cout << " nDetConstruction: Wrote " << lightMaps.size() << " light map(s) to \"" << lightMapFilename << "\"\n";
+	else
+		Display::ErrorPrint("Failed to write one or more light maps to file!", "nDetConstruction");
+
+	return retval;
+}
+
+void nDetConstruction::PrintLightMaps() const {
+	if(lightMaps.empty()){
+		std::cout << " nDetConstruction: No light maps are defined. User binning:\n";
+		lightMapBinning.print();
+		return;
+	}
+	int detCount = 0;
+	for(auto map : lightMaps){
+		std::cout << "***********************************************************\n";
+		std::cout << " Light map ID         = " << detCount++ << std::endl;
+		map->print();
+	}
+	std::cout << "***********************************************************\n";
+}
+
+void nDetConstruction::clearLightMaps(){
+	for(auto map : lightMaps)
+		delete map;
+	lightMaps.clear();
+}
+
+void nDetConstruction::SetProductionCut(const G4String &input){
+	std::vector<std::string> args;
+	unsigned int Nargs = split_str(input, args);
+	if(Nargs < 2){
+		std::cout << " nDetConstruction: Invalid number of arguments given to ::SetProductionCut(). Expected 2, received " << Nargs << ".\n";
+		std::cout << " nDetConstruction:  SYNTAX: <scint|detector|world> <cut>\n";
+		return;
+	}
+	G4double cut = strtod(args.at(1).c_str(), NULL)*mm;
+	if(cut < 0){
+		Display::ErrorPrint("Production cut must not be negative!", "nDetConstruction");
+		return;
+	}
+	if(args.at(0) == "scint"){
+		scintCut = cut;
+		applyProductionCut(scintRegion, scintCut);
+	}
+	else if(args.at(0) == "detector"){
+		detectorCut = cut;
+		applyProductionCut(detectorRegion, detectorCut);
+	}
+	else if(args.at(0) == "world"){
+		worldCut = cut;
+		applyProductionCut(worldRegion, worldCut);
+	}
+	else
+		Display::ErrorPrint("Unrecognized region name. Expected \"scint\", \"detector\", or \"world\".", "nDetConstruction");
+}
+
+void nDetConstruction::PrintProductionCuts() const {
+	std::cout << " nDetConstruction: Production cuts (0 = default cut of the world)\n";
+	std::cout << "  scint    = " << scintCut << " mm\n";
+	std::cout << "  detector = " << detectorCut << " mm\n";
+	std::cout << "  world    = " << worldCut << " mm\n";
+}
+
+bool nDetConstruction::IsInsideDetectors(const G4VPhysicalVolume *physV) const {
+	const G4Region *region = physV->GetLogicalVolume()->GetRegion();
+	return (region && (region == scintRegion || region == detectorRegion));
+}
+
+void nDetConstruction::SetPhysicsCacheDirectory(const std::string &dir){
+	physicsCacheDir = (dir != "off" ? dir : "");
+	if(expHall->getPhysicalVolume()) // Geometry already constructed
+		PreparePhysicsCache();
+}
+
+bool nDetConstruction::PreparePhysicsCache(){
+	physicsCacheRetrieved = false;
+	physicsCachePath = "";
+	if(!physicsList)
+		return false;
+	if(physicsCacheDir.empty()){
+		physicsList->ResetPhysicsTableRetrieved();
+		return false;
+	}
+
+	// Tables are only retrieved if the stored key matches exactly (i.e. not just its hash)
+	physicsCacheKey = getPhysicsCacheKey();
+	unsigned long long hash = 0xCBF29CE484222325ULL; // 64-bit FNV-1a
+	for(std::string::const_iterator iter = physicsCacheKey.begin(); iter != physicsCacheKey.end(); iter++){
+		hash ^= static_cast<unsigned char>(*iter);
+		hash *= 0x100000001B3ULL;
+	}
+	std::stringstream stream;
+	stream << physicsCacheDir << "/" << std::hex << std::setw(16) << std::setfill('0') << hash;
+	physicsCachePath = stream.str();
+
+	std::ifstream keyFile((physicsCachePath + "/nDetPhysicsCache.key").c_str());
+	if(keyFile.good()){
+		std::stringstream storedKey;
+		storedKey << keyFile.rdbuf();
+		physicsCacheRetrieved = (storedKey.str() == physicsCacheKey);
+	}
+
+	if(physicsCacheRetrieved){
+		std::cout << " nDetConstruction: Retrieving physics tables from \"" << physicsCachePath << "\"\n";
+		physicsList->SetPhysicsTableRetrieved(physicsCachePath);
+	}
+	else // Build the tables and store them at the start of the run
+		physicsList->ResetPhysicsTableRetrieved();
+
+	return physicsCacheRetrieved;
+}
+
+bool nDetConstruction::StorePhysicsCache(){
+	if(!physicsList || physicsCachePath.empty() || physicsCacheRetrieved)
+		return false;
+
+	// Materials or production cuts may have been modified since the geometry was constructed
+	if(getPhysicsCacheKey() != physicsCacheKey){
+		Display::WarningPrint("Materials or production cuts modified after geometry update, physics tables will not be cached!", "nDetConstruction");
+		physicsCachePath = "";
+		return false;
+	}
+
+	// Another job may have stored the same tables since the geometry was constructed
+	struct stat info;
+	if(stat(physicsCachePath.c_str(), &info) == 0){
+		nDetFastNeutronElastic::storeTables(physicsCachePath); // Skipped if already stored
+		physicsCacheRetrieved = true; // Only store the tables once
+		return false;
+	}
+
+	// Jobs sharing the cache may store the same tables concurrently. The tables are written to a directory which is unique
+	// to this job and then renamed onto the cache path, so other jobs only ever see complete sets of tables
+	char hostname[256] = "";
+	gethostname(hostname, sizeof(hostname)-1);
+	std::stringstream stream;
+	stream << physicsCachePath << ".tmp-" << hostname << "-" << getpid();
+	std::string tempPath = stream.str();
+
+	mkdir(physicsCacheDir.c_str(), 0755);
+	if(mkdir(tempPath.c_str(), 0755) != 0 || !physicsList->StorePhysicsTable(tempPath)){
+		Display::ErrorPrint("Failed to store physics tables in the cache directory!", "nDetConstruction");
+		removeDirectory(tempPath);
+		physicsCachePath = "";
+		return false;
+	}
+
+	nDetFastNeutronElastic::storeTables(tempPath);
+
+	std::ofstream keyFile((tempPath + "/nDetPhysicsCache.key").c_str());
+	keyFile << physicsCacheKey;
+	keyFile.close();
+
+	physicsCacheRetrieved = true; // Only store the tables once
+	if(rename(tempPath.c_str(), physicsCachePath.c_str()) != 0){ // Another job stored the tables first
+		removeDirectory(tempPath);
+		return false;
+	}
+
+	std::cout << " nDetConstruction: Stored physics tables in \"" << physicsCachePath << "\"\n";
+	
+	return true;
+}
+
+void nDetConstruction::removeDirectory(const std::string &path){
+	DIR *dir = opendir(path.c_str());
+	if(!dir)
+		return;
+	struct dirent *entry;
+	while((entry = readdir(dir))){ // The cache directories do not contain sub-directories
+		std::string name(entry->d_name);
+		if(name != "." && name != "..")
+			unlink((path + "/" + name).c_str());
+	}
+	closedir(dir);
+	rmdir(path.c_str());
+}
+
+std::string nDetConstruction::getPhysicsCacheKey() const {
+	std::stringstream stream;
+	stream << std::setprecision(10);
+	stream << "physics " << physicsListName << "\n";
+	stream << "version " << G4RunManager::GetRunManager()->GetVersionString() << "\n";
+
+	// All materials, including those loaded from material files
+	const G4MaterialTable *materialTable = G4Material::GetMaterialTable();
+	for(G4MaterialTable::const_iterator iter = materialTable->begin(); iter != materialTable->end(); iter++){
+		const G4Material *mat = (*iter);
+		stream << "material " << mat->GetName() << " " << mat->GetDensity()/(g/cm3) << " " << mat->GetState() << " " << mat->GetTemperature()/kelvin;
+		const G4double *fractions = mat->GetFractionVector();
+		for(size_t i = 0; i < mat->GetNumberOfElements(); i++)
+			stream << " " << mat->GetElement(i)->GetName() << ":" << fractions[i];
+		stream << "\n";
+	}
+
+	// Production cuts of all regions (including the default region of the world)
+	const char *particleNames[4] = {"gamma", "e-", "e+", "proton"};
+	G4RegionStore *store = G4RegionStore::GetInstance();
+	for(std::vector<G4Region*>::iterator iter = store->begin(); iter != store->end(); iter++){
+		const G4ProductionCuts *cuts = (*iter)->GetProductionCuts();
+		stream << "region " << (*iter)->GetName();
+		for(int i = 0; i < 4; i++)
+			stream << " " << (cuts ? cuts->GetProductionCut(particleNames[i])/mm : -1);
+		stream << "\n";
+	}
+
+	return stream.str();
+}
+
+void nDetConstruction::defineRegions(){
+	// Regions are kept between geometry updates. Deleted logical volumes remove themselves from their region
+	G4RegionStore *store = G4RegionStore::GetInstance();
+	if(!scintRegion){
+		scintRegion = store->FindOrCreateRegion("nDetScintillatorRegion");
+		detectorRegion = store->FindOrCreateRegion("nDetDetectorRegion");
+		worldRegion = store->FindOrCreateRegion("nDetWorldRegion");
+	}
+
+	// Each logical volume may only be added to a region once
+	std::set<G4LogicalVolume*> added;
+	G4PhysicalVolumeStore *physStore = G4PhysicalVolumeStore::GetInstance();
+	for(std::vector<G4VPhysicalVolume*>::iterator iter = physStore->begin(); iter != physStore->end(); iter++){
+		G4Region *region = NULL;
+		switch(GetVolumeRole(*iter)){
+			case ASSEMBLY:
+				region = detectorRegion;
+				break;
+			case SCINTILLATOR:
+				region = scintRegion;
+				break;
+			default:
+				continue;
+		}
+		G4LogicalVolume *logV = (*iter)->GetLogicalVolume();
+		if(added.insert(logV).second)
+			region->AddRootLogicalVolume(logV);
+	}
+
+	// The floor and all user objects are placed directly into the world
+	G4LogicalVolume *worldLogV = expHall->getLogicalVolume();
+	for(int i = 0; i < (int)worldLogV->GetNoDaughters(); i++){
+		G4VPhysicalVolume *daughter = worldLogV->GetDaughter(i);
+		if(GetVolumeRole(daughter) != ASSEMBLY && added.insert(daughter->GetLogicalVolume()).second)
+			worldRegion->AddRootLogicalVolume(daughter->GetLogicalVolume());
+	}
+
+	applyProductionCut(scintRegion, scintCut);
+	applyProductionCut(detectorRegion, detectorCut);
+	applyProductionCut(worldRegion, worldCut);
+}
+
+void nDetConstruction::applyProductionCut(G4Region *region, const G4double &cut){
+	if(!region) // Regions have not been defined yet
+		return;
+	G4ProductionCuts *defaultCuts = G4ProductionCutsTable::GetProductionCutsTable()->GetDefaultProductionCuts();
+	G4ProductionCuts *cuts = region->GetProductionCuts();
+	if(cut > 0){
+		if(!cuts || cuts == defaultCuts){ // The region needs its own cuts
+			cuts = new G4ProductionCuts();
+			region->SetProductionCuts(cuts);
+		}
+		cuts->SetProductionCut(cut);
+	}
+	else // Use the default production cuts of the world
+		region->SetProductionCuts(defaultCuts);
+}
+
+void nDetConstruction::classifyVolumes(){
+	volumeRoles.clear();
+	G4PhysicalVolumeStore *store = G4PhysicalVolumeStore::GetInstance();
+	for(std::vector<G4VPhysicalVolume*>::iterator iter = store->begin(); iter != store->end(); iter++){
+		G4int id = (*iter)->GetInstanceID();
+		if(id >= (G4int)volumeRoles.size())
+			volumeRoles.resize(id+1, UNCLASSIFIED);
+		
+		// Names are only compared here, once per geometry
+		const G4String &name = (*iter)->GetName();
+		if((*iter) == expHall->getPhysicalVolume())
+			volumeRoles[id] = WORLD;
+		else if(name == "Assembly")
+			volumeRoles[id] = ASSEMBLY;
+		else if(name.find("psSiPM") != std::string::npos)
+			volumeRoles[id] = SENSITIVE;
+		else if(name.find("Scint") != std::string::npos)
+			volumeRoles[id] = SCINTILLATOR;
+	}
+}
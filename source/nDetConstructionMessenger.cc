@@ -3,6 +3,7 @@
 
 #include "nDetConstructionMessenger.hh"
 #include "nDetConstruction.hh"
+#include "termColors.hh"
 
 #include "G4Material.hh"
 #include "G4UIcommand.hh"
@@ -100,7 +101,7 @@ void nDetConstructionMessenger::addAllCommands(){
 
 	addCommand(new G4UIcmdWithAString("/nDet/output/trace/setFunction", this));
 	addGuidance("Set the single photon response function (default=0)");
-	addCandidates("expo 0 vandle 1 gauss 2");
+	addCandidates("expo 0 vandle 1 gauss 2 custom 3");
 
 	addCommand(new G4UIcmdWithADouble("/nDet/output/trace/setAdcClock", this));
 	addGuidance("Set the period of the ADC clock (ns)");
@@ -114,6 +115,96 @@ void nDetConstructionMessenger::addAllCommands(){
 
 	addCommand(new G4UIcmdWithoutParameter("/nDet/output/trace/params", this));
 	addGuidance("Print pulse and digitizer settings");
+
+	addCommand(new G4UIcmdWithAString("/nDet/output/trace/loadFunction", this));
+	addGuidance("Load a measured single photon response (ascii or root file) and use it as the single photon response function");
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Light map commands
+	///////////////////////////////////////////////////////////////////////////////
+
+	addDirectory("/nDet/detector/lightMap/", "Optical photon light map control");
+
+	addCommand(new G4UIcmdWithAString("/nDet/detector/lightMap/build", this));
+	addGuidance("Track all optical photons and build light maps for all detectors. Maps are written to the specified root file at the end of each run");
+
+	addCommand(new G4UIcmdWithAString("/nDet/detector/lightMap/load", this));
+	addGuidance("Load light maps for all detectors from a root file and sample PMT hits from the maps instead of tracking optical photons");
+
+	addCommand(new G4UIcmdWithoutParameter("/nDet/detector/lightMap/disable", this));
+	addGuidance("Disable light map building and fast light map simulation");
+
+	addCommand(new G4UIcmdWithAString("/nDet/detector/lightMap/setVoxels", this));
+	addGuidance("Set the number of light map voxels along each axis of the detector. SYNTAX: setVoxels <nx> <ny> <nz>");
+
+	addCommand(new G4UIcmdWithAString("/nDet/detector/lightMap/setTimeBins", this));
+	addGuidance("Set the number of photon arrival time bins and the maximum arrival time (in ns). SYNTAX: setTimeBins <nbins> [tmax=50]");
+
+	addCommand(new G4UIcmdWithAString("/nDet/detector/lightMap/setPositionBins", this));
+	addGuidance("Set the number of photon hit position bins on the PMT surface. SYNTAX: setPositionBins <nx> [ny=nx]");
+
+	addCommand(new G4UIcmdWithoutParameter("/nDet/detector/lightMap/print", this));
+	addGuidance("Print information about all light maps");
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Optical photon commands
+	///////////////////////////////////////////////////////////////////////////////
+
+	addDirectory("/nDet/detector/photon/", "Optical photon transport control");
+
+	addCommand(new G4UIcmdWithADouble("/nDet/detector/photon/setSurvivalProbability", this));
+	addGuidance("Set the probability that a new optical photon will be tracked (default=1)");
+	addGuidance("Surviving photons are given a weight of 1/p so that the output remains unbiased");
+
+	addCommand(new G4UIcmdWithAString("/nDet/detector/photon/setQECulling", this));
+	addGuidance("Apply the PMT quantum efficiency to new optical photons at birth so that fewer photons are tracked. SYNTAX: setQECulling <off|max|wavelength>");
+	addGuidance("In \"max\" mode photons survive with the maximum quantum efficiency and detected photons are accepted with probability QE(lambda)/QEmax");
+	addGuidance("In \"wavelength\" mode photons survive with the quantum efficiency for their wavelength and all detected photons are accepted");
+	addGuidance("Detected photon counts only include accepted photons when enabled. Requires a PMT quantum efficiency spectrum");
+	addCandidates("off max wavelength");
+
+	addCommand(new G4UIcmdWithAString("/nDet/detector/photon/setMaxTime", this));
+	addGuidance("Kill optical photons after a maximum global time. SYNTAX: setMaxTime <off|auto|time>");
+	addGuidance("In \"auto\" mode the time is set to the end of the PMT acquisition window (trace length and delay) at the start of each run. Otherwise the time is in ns");
+
+	addCommand(new G4UIcmdWithADouble("/nDet/detector/photon/setMaxTrackLength", this));
+	addGuidance("Kill optical photons whose track length exceeds the specified length in mm (default=0, disabled)");
+
+	addCommand(new G4UIcmdWithAnInteger("/nDet/detector/photon/setMaxReflections", this));
+	addGuidance("Kill optical photons after the specified number of optical boundary reflections (default=0, disabled)");
+
+	addCommand(new G4UIcmdWithAString("/nDet/detector/photon/deferTracking", this));
+	addGuidance("Track optical photons only after all other particles have been tracked, and only if the event passes the optical trigger (default=false)");
+	addGuidance("The trigger requires the primary particle to enter a scintillator and to deposit at least the trigger threshold energy");
+	addCandidates("true false");
+
+	addCommand(new G4UIcmdWithADouble("/nDet/detector/photon/setTriggerThreshold", this));
+	addGuidance("Set the minimum energy deposited by the primary particle in the scintillators required to track optical photons in MeV (default=0)");
+	addGuidance("Only used when deferred optical photon tracking is enabled");
+
+	addCommand(new G4UIcmdWithAString("/nDet/detector/photon/trackOutsideDetectors", this));
+	addGuidance("Track optical photons outside of the detector assemblies (default=false)");
+	addGuidance("When disabled, optical photons generated outside of the detectors or entering the world volume are killed");
+	addCandidates("true false");
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Region commands
+	///////////////////////////////////////////////////////////////////////////////
+
+	addDirectory("/nDet/detector/region/", "Detector region control");
+
+	addCommand(new G4UIcmdWithAString("/nDet/detector/region/setProductionCut", this));
+	addGuidance("Set the production cut of a region in mm. SYNTAX: setProductionCut <scint|detector|world> <cut>");
+	addGuidance("\"scint\" contains the scintillators, \"detector\" the other detector components, and \"world\" the floor and world objects");
+	addGuidance("A cut of zero uses the default production cut (defaults: scint=0, detector=0, world=10 mm)");
+
+	addCommand(new G4UIcmdWithoutParameter("/nDet/detector/region/print", this));
+	addGuidance("Print the production cuts of all regions");
+
+	addCommand(new G4UIcmdWithAString("/nDet/detector/region/setPhysicsCache", this));
+	addGuidance("Set the directory used to store and retrieve physics tables. SYNTAX: setPhysicsCache <directory|off>");
+	addGuidance("Tables are keyed by the physics list, all materials, and the production cuts of all regions");
+	addGuidance("Set materials and production cuts before updating the geometry, otherwise the tables will be rebuilt");
 }
 
 void nDetConstructionMessenger::SetNewChildValue(G4UIcommand* command, G4String newValue){
@@ -153,7 +244,7 @@ void nDetConstructionMessenger::SetNewChildValue(G4UIcommand* command, G4String
 	else if(index == 10){
 		fDetector->PrintAllDetectors();
 	}
-	else{ // Digitizer command
+	else if(index <= 28){ // Digitizer command
 		pmtResponse *prL = fDetector->GetPmtResponseL();
 		pmtResponse *prR = fDetector->GetPmtResponseR();
 		index = index - 11;
@@ -229,6 +320,14 @@ void nDetConstructionMessenger::SetNewChildValue(G4UIcommand* command, G4String
 				prL->setFunctionType(pmtResponse::GAUSS);
 				prR->setFunctionType(pmtResponse::GAUSS);
 			}
+			else if(newValue == "custom" || newValue == "3"){ // Requires a response loaded with loadFunction
+				if(!prL->hasSinglePhotonResponse() || !prR->hasSinglePhotonResponse()){
+					Display::ErrorPrint("No single photon response loaded, use loadFunction before selecting the custom response!", "nDetConstructionMessenger");
+					return;
+				}
+				prL->setFunctionType(pmtResponse::CUSTOM);
+				prR->setFunctionType(pmtResponse::CUSTOM);
+			}
 		}
 		else if(index == 13){
 			G4double val = command->ConvertToDouble(newValue);
@@ -247,5 +346,72 @@ void nDetConstructionMessenger::SetNewChildValue(G4UIcommand* command, G4String
 		else if(index == 16){
 			prL->print(); // Only show the left side, because they're both the same
 		}
+		else if(index == 17){
+			if(!(prL->loadSinglePhotonResponse(newValue.c_str()) && prR->loadSinglePhotonResponse(newValue.c_str())))
+				Display::ErrorPrint("Failed to load single photon response from file!", "nDetConstructionMessenger");
+		}
+	}
+	else if(index <= 35){ // Light map command
+		index = index - 29;
+		if(index == 0){
+			fDetector->BuildLightMap(newValue);
+		}
+		else if(index == 1){
+			fDetector->LoadLightMap(newValue);
+		}
+		else if(index == 2){
+			fDetector->DisableLightMap();
+		}
+		else if(index == 3){
+			fDetector->SetLightMapVoxels(newValue);
+		}
+		else if(index == 4){
+			fDetector->SetLightMapTimeBins(newValue);
+		}
+		else if(index == 5){
+			fDetector->SetLightMapPositionBins(newValue);
+		}
+		else if(index == 6){
+			fDetector->PrintLightMaps();
+		}
+	}
+	else if(index <= 43){ // Optical photon command
+		index = index - 36;
+		if(index == 0){
+			fDetector->SetPhotonSurvivalProbability(command->ConvertToDouble(newValue));
+		}
+		else if(index == 1){
+			fDetector->SetQuantumEfficiencyCulling(newValue);
+		}
+		else if(index == 2){
+			fDetector->SetPhotonTimeCut(newValue);
+		}
+		else if(index == 3){
+			fDetector->SetPhotonMaxTrackLength(command->ConvertToDouble(newValue));
+		}
+		else if(index == 4){
+			fDetector->SetPhotonMaxReflections(command->ConvertToInt(newValue));
+		}
+		else if(index == 5){
+			fDetector->SetDeferOpticalPhotons((newValue == "true") ? true : false);
+		}
+		else if(index == 6){
+			fDetector->SetOpticalTriggerThreshold(command->ConvertToDouble(newValue));
+		}
+		else if(index == 7){
+			fDetector->SetTrackPhotonsOutsideDetectors((newValue == "true") ? true : false);
+		}
+	}
+	else{ // Region command
+		index = index - 44;
+		if(index == 0){
+			fDetector->SetProductionCut(newValue);
+		}
+		else if(index == 1){
+			fDetector->PrintProductionCuts();
+		}
+		else if(index == 2){
+			fDetector->SetPhysicsCacheDirectory(newValue);
+		}
 	}
 }
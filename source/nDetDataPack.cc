@@ -1,6 +1,7 @@
 #include <iostream>
 
 #include "TBranch.h"
+#include "TTree.h"
 
 #include "nDetDataPack.hh"
 
@@ -20,6 +21,23 @@ void nDetDataPack::copyData(nDetEventStructure *evt, nDetOutputStructure *out, n
 	(*trace) = (*traceData);
 }
 
+void nDetDataPack::copyData(const nDetDataPack &other){
+	other.copyData(evtData, outData, multData, debugData, traceData);
+}
+
+void nDetDataPack::setBranches(TTree *tree, const bool &singleDetector, const bool &debug, const bool &trace){
+	tree->Branch("event", &evtData);
+	if(singleDetector){ // Add the single-detector branches
+		tree->Branch("output", &outData);
+		if(debug) // Add the debug branch
+			tree->Branch("debug", &debugData);
+	}
+	else // Add the multiple-detector branch
+		tree->Branch("output", &multData);
+	if(trace) // Add the trace branch
+		tree->Branch("trace", &traceData);
+}
+
 bool nDetDataPack::goodEvent() const {
 	return (evtData->goodEvent || (debugData->nPhotons[0] > 0 || debugData->nPhotons[1] > 0));
 }
@@ -0,0 +1,70 @@
+#include <sstream>
+
+#include "Randomize.hh"
+
+#include "nDetEventSeeder.hh"
+
+// Moduli of the two generators of the RANECU engine. Seeds must lie in [1, m-1]
+const unsigned long long ranecuModulus1 = 2147483563ULL;
+const unsigned long long ranecuModulus2 = 2147483399ULL;
+
+/** Mix a 64-bit state using the SplitMix64 finalizer
+  */
+unsigned long long splitMix64(unsigned long long &state){
+	unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+bool nDetEventSeeder::setShard(const long &index, const long &count){
+	if(count <= 0 || index < 0 || index >= count)
+		return false;
+	shardIndex = index;
+	shardCount = count;
+	return true;
+}
+
+bool nDetEventSeeder::setFirstEvent(const long &id){
+	if(id < 0)
+		return false;
+	firstEvent = id;
+	return true;
+}
+
+void nDetEventSeeder::beginRun(const int &runID, const long &numEvents){
+	runOffset = firstEvent + eventsProcessed*shardCount + shardIndex*numEvents;
+	eventsProcessed += numEvents;
+	runOffsets.push_back(std::make_pair(runID, runOffset));
+}
+
+void nDetEventSeeder::seedEvent(const long &eventID) const {
+	long seeds[3];
+	deriveSeeds(masterSeed, getGlobalEventID(eventID), seeds);
+	G4Random::setTheSeeds(seeds);
+}
+
+void nDetEventSeeder::deriveSeeds(const long &seed, const long &globalID, long *seeds){
+	// Combine the master seed and the event ID into a single well-mixed state
+	unsigned long long state = static_cast<unsigned long long>(seed);
+	state = splitMix64(state) ^ static_cast<unsigned long long>(globalID);
+	seeds[0] = static_cast<long>(1 + splitMix64(state) % (ranecuModulus1 - 1));
+	seeds[1] = static_cast<long>(1 + splitMix64(state) % (ranecuModulus2 - 1));
+	seeds[2] = 0;
+}
+
+std::string nDetEventSeeder::getSchemeString() const {
+	std::stringstream stream;
+	stream << "per-event splitmix64(seed, globalEventID); seed=" << masterSeed << ", shard=" << shardIndex << "/" << shardCount << ", firstEvent=" << firstEvent;
+	return stream.str();
+}
+
+std::string nDetEventSeeder::getOffsetString() const {
+	std::stringstream stream;
+	for(std::vector<std::pair<int, long> >::const_iterator iter = runOffsets.begin(); iter != runOffsets.end(); iter++){
+		if(iter != runOffsets.begin())
+			stream << " ";
+		stream << iter->first << ":" << iter->second;
+	}
+	return stream.str();
+}
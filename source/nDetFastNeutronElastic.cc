@@ -0,0 +1,443 @@
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "G4HadronicProcess.hh"
+#include "G4HadronicProcessType.hh"
+#include "G4HadProjectile.hh"
+#include "G4Nucleus.hh"
+#include "G4DynamicParticle.hh"
+#include "G4ProcessManager.hh"
+#include "G4ProcessVector.hh"
+#include "G4Neutron.hh"
+#include "G4Proton.hh"
+#include "G4IonTable.hh"
+#include "G4Material.hh"
+#include "G4Element.hh"
+#include "G4LogicalVolume.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4PhysicalVolumeStore.hh"
+#include "G4NavigationHistory.hh"
+#include "G4TouchableHistory.hh"
+#include "G4Track.hh"
+#include "G4Step.hh"
+#include "G4Threading.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4PhysicalConstants.hh"
+#include "Randomize.hh"
+
+#include "nDetFastNeutronElastic.hh"
+#include "nDetConstruction.hh"
+#include "termColors.hh"
+
+// Neutron energy range covered by the tables
+const G4double tableMinEnergy = 0.1*MeV;
+const G4double tableMaxEnergy = 20*MeV;
+
+// Number of points of the cross section tables
+const int numXsPoints = 2000;
+
+// Number of energies and equiprobable bins of the angular distribution tables
+const int numAngEnergies = 64;
+const int numAngBins = 32;
+
+// Number of HP final states sampled per target and energy when building the angular distribution tables
+const int numAngSamples = 2000;
+
+// Logarithmic energy steps of the tables
+const G4double xsLogStep = std::log(tableMaxEnergy/tableMinEnergy)/(numXsPoints-1);
+const G4double angLogStep = std::log(tableMaxEnergy/tableMinEnergy)/(numAngEnergies-1);
+
+// Atomic numbers of the tabulated targets
+const G4int tableZ[2] = {1, 6};
+
+/** Get the table index of a target (0 for hydrogen, 1 for carbon, and -1 otherwise)
+  */
+int getTableIndex(const G4int &Z){
+	return (Z == 1 ? 0 : (Z == 6 ? 1 : -1));
+}
+
+/** Return true if material @a mat is composed solely of hydrogen and carbon and return false otherwise
+  */
+bool isHydrocarbon(const G4Material *mat){
+	for(size_t i = 0; i < mat->GetNumberOfElements(); i++){
+		if(getTableIndex(mat->GetElement(i)->GetZ_asInt()) < 0)
+			return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// class nDetFastNeutronElasticXS
+///////////////////////////////////////////////////////////////////////////////
+
+G4bool nDetFastNeutronElasticXS::IsElementApplicable(const G4DynamicParticle *particle, G4int Z, const G4Material *mat/*=0*/){
+	return (getTableIndex(Z) >= 0 && nDetFastNeutronElastic::isTabulated(particle->GetKineticEnergy()) && hasMaterial(mat));
+}
+
+G4double nDetFastNeutronElasticXS::GetElementCrossSection(const G4DynamicParticle *particle, G4int Z, const G4Material*/*=0*/){
+	return nDetFastNeutronElastic::getCrossSection(Z, particle->GetKineticEnergy());
+}
+
+bool nDetFastNeutronElasticXS::hasMaterial(const G4Material *mat) const {
+	return (mat && std::find(materials.begin(), materials.end(), mat) != materials.end());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// class nDetFastNeutronElastic
+///////////////////////////////////////////////////////////////////////////////
+
+bool nDetFastNeutronElastic::tablesBuilt = false;
+std::vector<G4double> nDetFastNeutronElastic::xsTable[2];
+std::vector<G4double> nDetFastNeutronElastic::angTable[2];
+std::string nDetFastNeutronElastic::tablesMaterial;
+
+nDetFastNeutronElastic::nDetFastNeutronElastic(G4HadronicInteraction *hp, G4HadronicProcess *process, nDetFastNeutronElasticXS *xs) :
+	G4HadronicInteraction("nDetFastNeutronElastic"), hpModel(hp), elasticProcess(process), crossSections(xs), numMaterials(0)
+{
+	// Cover the same energy range as HP, so that transitions to the high energy model are unchanged
+	SetMinEnergy(hpModel->GetMinEnergy());
+	SetMaxEnergy(hpModel->GetMaxEnergy());
+}
+
+G4bool nDetFastNeutronElastic::IsApplicable(const G4HadProjectile &proj, G4Nucleus&){
+	return isHydrocarbon(proj.GetMaterial());
+}
+
+G4HadFinalState *nDetFastNeutronElastic::ApplyYourself(const G4HadProjectile &proj, G4Nucleus &target){
+	G4double energy = proj.GetKineticEnergy();
+	int index = getTableIndex(target.GetZ_asInt());
+	if(index < 0 || !isTabulated(energy) || !crossSections->hasMaterial(proj.GetMaterial())) // Not tabulated, use HP
+		return hpModel->ApplyYourself(proj, target);
+
+	theParticleChange.Clear();
+	theParticleChange.SetStatusChange(isAlive);
+
+	// Get the recoil nucleus
+	G4int Z = target.GetZ_asInt();
+	G4int A = target.GetA_asInt();
+	const G4ParticleDefinition *recoil = (Z == 1 && A == 1 ? G4Proton::Definition() : G4IonTable::GetIonTable()->GetIon(Z, A, 0.0));
+
+	// Boost to the center-of-mass frame
+	G4double m1 = proj.GetDefinition()->GetPDGMass();
+	G4double m2 = recoil->GetPDGMass();
+	G4LorentzVector lv1 = proj.Get4Momentum();
+	G4LorentzVector lv(0, 0, 0, m2);
+	lv += lv1;
+	G4ThreeVector bst = lv.boostVector();
+	lv1.boost(-bst);
+	G4ThreeVector p1 = lv1.vect();
+	G4double ptot = p1.mag();
+
+	// Sample the scattering angle in the center-of-mass frame
+	G4double cost = sampleCosTheta(index, energy);
+	G4double sint = std::sqrt((1-cost)*(1+cost));
+	G4double phi = twopi*G4UniformRand();
+	G4ThreeVector v1(sint*std::cos(phi), sint*std::sin(phi), cost);
+	v1.rotateUz(p1.unit());
+	v1 *= ptot;
+
+	// Boost back to the lab frame
+	G4LorentzVector nlv1(v1, std::sqrt(ptot*ptot + m1*m1));
+	nlv1.boost(bst);
+	G4LorentzVector nlv2 = lv - nlv1;
+
+	theParticleChange.SetEnergyChange(std::max(nlv1.e() - m1, 0.0));
+	theParticleChange.SetMomentumChange(nlv1.vect().unit());
+	if(nlv2.e() - m2 > 0)
+		theParticleChange.AddSecondary(new G4DynamicParticle(recoil, nlv2));
+
+	return &theParticleChange;
+}
+
+void nDetFastNeutronElastic::BuildPhysicsTable(const G4ParticleDefinition &particle){
+	// The energy range manager selects models by energy range only, so exactly one of HP and this model must be active in each
+	// material. This model handles all hydrocarbons, passing scatters in the materials which are not registered to HP, so that
+	// scintillator materials may still be registered after a geometry update. Materials are only ever added to the table
+	const G4MaterialTable *materials = G4Material::GetMaterialTable();
+	for(; numMaterials < materials->size(); numMaterials++){
+		const G4Material *mat = (*materials)[numMaterials];
+		if(isHydrocarbon(mat))
+			hpModel->DeActivateFor(mat);
+		else
+			DeActivateFor(mat);
+	}
+
+	// Find all scintillator materials of the current geometry
+	nDetConstruction *detector = &nDetConstruction::getInstance();
+	std::vector<G4VPhysicalVolume*> candidates;
+	G4PhysicalVolumeStore *store = G4PhysicalVolumeStore::GetInstance();
+	for(std::vector<G4VPhysicalVolume*>::iterator iter = store->begin(); iter != store->end(); iter++){
+		if(detector->GetVolumeRole(*iter) != nDetConstruction::SCINTILLATOR)
+			continue;
+		const G4Material *mat = (*iter)->GetLogicalVolume()->GetMaterial();
+		if(crossSections->hasMaterial(mat) || std::find(rejectedMaterials.begin(), rejectedMaterials.end(), mat) != rejectedMaterials.end())
+			continue;
+		if(isHydrocarbon(mat))
+			candidates.push_back(*iter);
+		else{
+			if(G4Threading::IsMasterThread())
+				Display::WarningPrint("Scintillator material \"" + mat->GetName() + "\" contains elements other than H and C, using HP!", "nDetFastNeutronElastic");
+			rejectedMaterials.push_back(mat);
+		}
+	}
+	if(candidates.empty())
+		return;
+
+	// The tables are shared by all threads and are only built once, before any worker builds its physics tables
+	if(!tablesBuilt && G4Threading::IsMasterThread()){
+		tablesBuilt = buildTables(particle, candidates.front());
+		if(tablesBuilt) // Stored with the physics tables at the start of the run instead if the cache sub-directory does not exist yet
+			storeTables(detector->GetPhysicsCachePath());
+	}
+	if(!tablesBuilt)
+		return;
+
+	// Use the tables inside the scintillator materials. Materials stay registered for the rest of the job
+	for(std::vector<G4VPhysicalVolume*>::iterator iter = candidates.begin(); iter != candidates.end(); iter++){
+		const G4Material *mat = (*iter)->GetLogicalVolume()->GetMaterial();
+		if(crossSections->hasMaterial(mat))
+			continue;
+		bool tabulated = true;
+		for(size_t i = 0; i < mat->GetNumberOfElements(); i++){ // The first material may not contain both elements
+			int index = getTableIndex(mat->GetElement(i)->GetZ_asInt());
+			if(index < 0 || xsTable[index][0] <= 0)
+				tabulated = false;
+		}
+		if(!tabulated)
+			continue;
+		crossSections->addMaterial(mat);
+		if(G4Threading::IsMasterThread())
+			std::cout << " nDetFastNeutronElastic: Using tabulated n-p and n-C elastic scattering in \"" << mat->GetName() << "\"\n";
+	}
+}
+
+bool nDetFastNeutronElastic::isTabulated(const G4double &energy){
+	return (tablesBuilt && energy >= tableMinEnergy && energy <= tableMaxEnergy);
+}
+
+G4double nDetFastNeutronElastic::getCrossSection(const G4int &Z, const G4double &energy){
+	int index = getTableIndex(Z);
+	if(index < 0 || !isTabulated(energy))
+		return 0;
+	G4double x = std::log(energy/tableMinEnergy)/xsLogStep;
+	int bin = std::min((int)x, numXsPoints-2);
+	G4double frac = x - bin;
+	return ((1-frac)*xsTable[index][bin] + frac*xsTable[index][bin+1]);
+}
+
+bool nDetFastNeutronElastic::buildTables(const G4ParticleDefinition &particle, G4VPhysicalVolume *volume){
+	G4Material *mat = volume->GetLogicalVolume()->GetMaterial();
+	tablesMaterial = mat->GetName();
+
+	// Building the tables samples about 2.5M HP final states, so they are kept with the cached physics tables (if enabled)
+	std::string cachePath = nDetConstruction::getInstance().GetPhysicsCachePath();
+	if(!cachePath.empty() && retrieveTables(cachePath)){
+		std::cout << " nDetFastNeutronElastic: Retrieved n-p and n-C elastic tables from \"" << getTablesFilename(cachePath) << "\"\n";
+		return true;
+	}
+
+	std::cout << " nDetFastNeutronElastic: Building n-p and n-C elastic tables from HP using \"" << mat->GetName() << "\"\n";
+
+	// Tabulate the HP cross sections. The tabulated cross sections are not applicable to any material yet
+	for(int index = 0; index < 2; index++){
+		const G4Element *element = NULL;
+		for(size_t i = 0; i < mat->GetNumberOfElements(); i++){
+			if(mat->GetElement(i)->GetZ_asInt() == tableZ[index])
+				element = mat->GetElement(i);
+		}
+		xsTable[index].assign(numXsPoints, 0);
+		if(!element) // Not in this material, this target will never be sampled in it
+			continue;
+		for(int i = 0; i < numXsPoints; i++){
+			G4DynamicParticle neutron(&particle, G4ThreeVector(0, 0, 1), tableMinEnergy*std::exp(i*xsLogStep));
+			xsTable[index][i] = elasticProcess->GetElementCrossSection(&neutron, element, mat);
+		}
+	}
+
+	// HP samples the target element itself, so the final states are sampled using a track inside the scintillator
+	G4NavigationHistory history;
+	history.SetFirstEntry(volume);
+	G4TouchableHandle touchable(new G4TouchableHistory(history));
+	G4Step step;
+	step.GetPreStepPoint()->SetMaterial(mat);
+	step.GetPreStepPoint()->SetTouchableHandle(touchable);
+	G4Track track(new G4DynamicParticle(&particle, G4ThreeVector(0, 0, 1), tableMinEnergy), 0, G4ThreeVector());
+	track.SetTouchableHandle(touchable);
+	track.SetStep(&step);
+
+	// Tabulate the center-of-mass angle cosine quantiles, computed from the recoil energy of each HP final state
+	std::vector<G4double> samples[2];
+	for(int index = 0; index < 2; index++)
+		angTable[index].assign(numAngEnergies*(numAngBins+1), 0);
+	for(int i = 0; i < numAngEnergies; i++){
+		G4double energy = tableMinEnergy*std::exp(i*angLogStep);
+		track.SetKineticEnergy(energy);
+		track.SetMomentumDirection(G4ThreeVector(0, 0, 1));
+		samples[0].clear();
+		samples[1].clear();
+		for(int attempt = 0; attempt < 20*numAngSamples && (samples[0].size() < (size_t)numAngSamples || samples[1].size() < (size_t)numAngSamples); attempt++){
+			G4HadProjectile proj(track);
+			G4Nucleus target;
+			G4HadFinalState *result = hpModel->ApplyYourself(proj, target);
+			for(int j = 0; j < (int)result->GetNumberOfSecondaries(); j++){
+				G4DynamicParticle *secondary = result->GetSecondary(j)->GetParticle();
+				int index = getTableIndex((G4int)std::floor(secondary->GetDefinition()->GetPDGCharge()/eplus + 0.5));
+				if(index >= 0 && secondary->GetDefinition() != G4Neutron::Definition()){
+					G4double ratio = secondary->GetDefinition()->GetPDGMass()/particle.GetPDGMass();
+					G4double cost = 1 - secondary->GetKineticEnergy()*(ratio+1)*(ratio+1)/(2*ratio*energy);
+					samples[index].push_back(std::max(-1.0, std::min(1.0, cost)));
+				}
+				delete secondary;
+			}
+			result->Clear();
+		}
+
+		// Build the equiprobable bins
+		for(int index = 0; index < 2; index++){
+			if(samples[index].empty()){
+				if(xsTable[index][0] <= 0) // Not in this material
+					continue;
+				std::stringstream stream;
+				stream << "Failed to sample HP final states of Z=" << tableZ[index] << " at " << energy/MeV << " MeV!";
+				Display::ErrorPrint(stream.str(), "nDetFastNeutronElastic");
+				return false;
+			}
+			std::sort(samples[index].begin(), samples[index].end());
+			G4double *quantiles = &angTable[index][i*(numAngBins+1)];
+			for(int j = 0; j <= numAngBins; j++)
+				quantiles[j] = samples[index][(j*(samples[index].size()-1))/numAngBins];
+		}
+	}
+
+	return true;
+}
+
+bool nDetFastNeutronElastic::storeTables(const std::string &dir){
+	if(!tablesBuilt || dir.empty())
+		return false;
+
+	std::string filename = getTablesFilename(dir);
+	std::ifstream storedFile(filename.c_str());
+	if(storedFile.good())
+		return false;
+
+	// Write to a temporary file first, so that jobs sharing the cache never read an incomplete file
+	char hostname[256] = "";
+	gethostname(hostname, sizeof(hostname)-1);
+	std::stringstream stream;
+	stream << filename << ".tmp-" << hostname << "-" << getpid();
+	std::string tempFilename = stream.str();
+	std::ofstream tableFile(tempFilename.c_str());
+	if(!tableFile.good()) // The cache sub-directory does not exist
+		return false;
+	tableFile << "nDetFastNeutronElastic " << numXsPoints << " " << numAngEnergies << " " << numAngBins << " " << tableMinEnergy/MeV << " " << tableMaxEnergy/MeV << "\n";
+	tableFile << std::setprecision(17);
+	for(int index = 0; index < 2; index++){
+		for(std::vector<G4double>::iterator iter = xsTable[index].begin(); iter != xsTable[index].end(); iter++)
+			tableFile << (*iter) << "\n";
+		for(std::vector<G4double>::iterator iter = angTable[index].begin(); iter != angTable[index].end(); iter++)
+			tableFile << (*iter) << "\n";
+	}
+	tableFile.close();
+
+	if(tableFile.fail() || rename(tempFilename.c_str(), filename.c_str()) != 0){
+		unlink(tempFilename.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool nDetFastNeutronElastic::retrieveTables(const std::string &dir){
+	std::ifstream tableFile(getTablesFilename(dir).c_str());
+	if(!tableFile.good())
+		return false;
+
+	// The tables are only retrieved if they were built using the same grids
+	std::stringstream expected, header;
+	expected << "nDetFastNeutronElastic " << numXsPoints << " " << numAngEnergies << " " << numAngBins << " " << tableMinEnergy/MeV << " " << tableMaxEnergy/MeV;
+	std::string line;
+	std::getline(tableFile, line);
+	if(line != expected.str()){
+		Display::WarningPrint("Cached n-p and n-C elastic tables were built using different grids, rebuilding tables!", "nDetFastNeutronElastic");
+		return false;
+	}
+
+	for(int index = 0; index < 2; index++){
+		xsTable[index].assign(numXsPoints, 0);
+		angTable[index].assign(numAngEnergies*(numAngBins+1), 0);
+		for(std::vector<G4double>::iterator iter = xsTable[index].begin(); iter != xsTable[index].end(); iter++)
+			tableFile >> (*iter);
+		for(std::vector<G4double>::iterator iter = angTable[index].begin(); iter != angTable[index].end(); iter++)
+			tableFile >> (*iter);
+	}
+
+	if(tableFile.fail()){
+		Display::WarningPrint("Failed to read cached n-p and n-C elastic tables, rebuilding tables!", "nDetFastNeutronElastic");
+		return false;
+	}
+
+	return true;
+}
+
+std::string nDetFastNeutronElastic::getTablesFilename(const std::string &dir){
+	return (dir + "/nDetFastNeutronElastic." + tablesMaterial + ".dat");
+}
+
+G4double nDetFastNeutronElastic::sampleCosTheta(const int &index, const G4double &energy) const {
+	// Select one of the neighbouring energies with a probability given by the distance to each energy
+	G4double x = std::log(energy/tableMinEnergy)/angLogStep;
+	int bin = std::min((int)x, numAngEnergies-2);
+	if(G4UniformRand() < x - bin)
+		bin++;
+
+	// Linear interpolation within a randomly selected equiprobable bin
+	const G4double *quantiles = &angTable[index][bin*(numAngBins+1)];
+	G4double u = G4UniformRand()*numAngBins;
+	int j = std::min((int)u, numAngBins-1);
+	return (quantiles[j] + (quantiles[j+1]-quantiles[j])*(u-j));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// class nDetFastNeutronPhysics
+///////////////////////////////////////////////////////////////////////////////
+
+void nDetFastNeutronPhysics::ConstructProcess(){
+	// Find the neutron elastic process
+	G4HadronicProcess *elastic = NULL;
+	G4ProcessVector *processes = G4Neutron::Definition()->GetProcessManager()->GetProcessList();
+	for(size_t i = 0; i < (size_t)processes->size(); i++){
+		if((*processes)[i]->GetProcessSubType() == fHadronElastic){
+			elastic = dynamic_cast<G4HadronicProcess*>((*processes)[i]);
+			break;
+		}
+	}
+	if(!elastic){
+		Display::ErrorPrint("Failed to find the neutron elastic process, using HP for all neutron scatters!", "nDetFastNeutronPhysics");
+		return;
+	}
+
+	// Find the HP elastic model
+	G4HadronicInteraction *hp = NULL;
+	std::vector<G4HadronicInteraction*> &models = elastic->GetHadronicInteractionList();
+	for(std::vector<G4HadronicInteraction*>::iterator iter = models.begin(); iter != models.end(); iter++){
+		if((*iter)->GetModelName().find("HPElastic") != std::string::npos){
+			hp = (*iter);
+			break;
+		}
+	}
+	if(!hp){
+		Display::ErrorPrint("Failed to find the HP neutron elastic model, using default neutron elastic scattering!", "nDetFastNeutronPhysics");
+		return;
+	}
+
+	// The tabulated cross sections take precedence over the data sets added before
+	nDetFastNeutronElasticXS *xs = new nDetFastNeutronElasticXS();
+	elastic->AddDataSet(xs);
+	elastic->RegisterMe(new nDetFastNeutronElastic(hp, elastic, xs));
+}
@@ -0,0 +1,309 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#include "TFile.h"
+#include "TTree.h"
+
+#include "Randomize.hh"
+
+#include "nDetLightMap.hh"
+#include "termColors.hh"
+
+///////////////////////////////////////////////////////////////////////////////
+// class nDetLightMap
+///////////////////////////////////////////////////////////////////////////////
+
+nDetLightMap::nDetLightMap() : nBinsX(8), nBinsY(8), nBinsZ(40), nTimeBins(100), nPosBinsX(16), nPosBinsY(16), nVoxels(0),
+                               tMax(50), faceWidth(0), faceHeight(0), size(0, 0, 0), voxelSize(0, 0, 0) {
+}
+
+double nDetLightMap::getNumGenerated() const {
+	double retval = 0;
+	for(auto count : nGenerated)
+		retval += count;
+	return retval;
+}
+
+double nDetLightMap::getNumDetected(const bool &isLeft) const {
+	double retval = 0;
+	for(size_t i = (isLeft ? 0 : 1); i < nDetected.size(); i += 2)
+		retval += nDetected[i];
+	return retval;
+}
+
+bool nDetLightMap::initialize(const G4ThreeVector &size_, const double &faceWidth_, const double &faceHeight_){
+	if(size_.getX() <= 0 || size_.getY() <= 0 || size_.getZ() <= 0 || faceWidth_ <= 0 || faceHeight_ <= 0){
+		Display::ErrorPrint("Cannot initialize light map with zero size!", "nDetLightMap");
+		return false;
+	}
+
+	size = size_;
+	faceWidth = faceWidth_;
+	faceHeight = faceHeight_;
+	voxelSize = G4ThreeVector(size.getX()/nBinsX, size.getY()/nBinsY, size.getZ()/nBinsZ);
+	nVoxels = nBinsX*nBinsY*nBinsZ;
+
+	nGenerated = std::vector<double>(nVoxels, 0);
+	nDetected = std::vector<double>(2*nVoxels, 0);
+	hitSumZ = std::vector<double>(2*nVoxels, 0);
+	timeHist = std::vector<float>(2*nVoxels*nTimeBins, 0);
+	posHist = std::vector<float>(2*nVoxels*nPosBinsX*nPosBinsY, 0);
+	timeCdf.clear();
+	posCdf.clear();
+
+	return true;
+}
+
+void nDetLightMap::setNumVoxels(const short &nx, const short &ny, const short &nz){
+	nBinsX = (nx > 0 ? nx : 1);
+	nBinsY = (ny > 0 ? ny : 1);
+	nBinsZ = (nz > 0 ? nz : 1);
+}
+
+void nDetLightMap::setTimeBins(const short &nbins, const double &tmax){
+	nTimeBins = (nbins > 0 ? nbins : 1);
+	tMax = (tmax > 0 ? tmax : 50);
+}
+
+void nDetLightMap::setPositionBins(const short &nx, const short &ny){
+	nPosBinsX = (nx > 0 ? nx : 1);
+	nPosBinsY = (ny > 0 ? ny : 1);
+}
+
+void nDetLightMap::copyBinning(const nDetLightMap &other){
+	nBinsX = other.nBinsX;
+	nBinsY = other.nBinsY;
+	nBinsZ = other.nBinsZ;
+	nTimeBins = other.nTimeBins;
+	nPosBinsX = other.nPosBinsX;
+	nPosBinsY = other.nPosBinsY;
+	tMax = other.tMax;
+}
+
+bool nDetLightMap::checkSize(const G4ThreeVector &size_) const {
+	if(empty()) return false;
+	return ((size_-size).mag() < 1E-6);
+}
+
+bool nDetLightMap::findVoxel(const G4ThreeVector &pos, size_t &index) const {
+	if(empty()) return false;
+	int ix = (int)std::floor((pos.getX()+size.getX()/2)/voxelSize.getX());
+	int iy = (int)std::floor((pos.getY()+size.getY()/2)/voxelSize.getY());
+	int iz = (int)std::floor((pos.getZ()+size.getZ()/2)/voxelSize.getZ());
+	if((ix < 0 || ix >= nBinsX) || (iy < 0 || iy >= nBinsY) || (iz < 0 || iz >= nBinsZ))
+		return false;
+	index = (ix*nBinsY + iy)*nBinsZ + iz;
+	return true;
+}
+
+void nDetLightMap::addGenerated(const G4ThreeVector &pos){
+	size_t index;
+	if(!findVoxel(pos, index)) return;
+	std::lock_guard<std::mutex> lock(mapLock);
+	nGenerated[index] += 1;
+}
+
+void nDetLightMap::addDetected(const G4ThreeVector &pos, const bool &isLeft, const double &dt, const G4ThreeVector &hit){
+	size_t index;
+	if(!findVoxel(pos, index)) return;
+
+	// Photons arriving later than the maximum time are added to the final bin
+	int tbin = (int)std::floor(dt/(tMax/nTimeBins));
+	tbin = std::max(0, std::min(tbin, nTimeBins-1));
+
+	// Photons striking outside of the photo-sensitive surface are added to the nearest edge bin
+	int xbin = (int)std::floor((hit.getX()+faceWidth/2)/(faceWidth/nPosBinsX));
+	int ybin = (int)std::floor((hit.getY()+faceHeight/2)/(faceHeight/nPosBinsY));
+	xbin = std::max(0, std::min(xbin, nPosBinsX-1));
+	ybin = std::max(0, std::min(ybin, nPosBinsY-1));
+
+	size_t pmt = 2*index + (isLeft ? 0 : 1);
+
+	std::lock_guard<std::mutex> lock(mapLock);
+	nDetected[pmt] += 1;
+	hitSumZ[pmt] += hit.getZ();
+	timeHist[pmt*nTimeBins + tbin] += 1;
+	posHist[pmt*nPosBinsX*nPosBinsY + xbin*nPosBinsY + ybin] += 1;
+}
+
+bool nDetLightMap::sample(const size_t &index, bool &isLeft, double &dt, G4ThreeVector &hit) const {
+	if(index >= nVoxels || nGenerated[index] <= 0)
+		return false;
+
+	// Select which PMT (if any) detects the photon
+	double rand = G4UniformRand()*nGenerated[index];
+	if(rand < nDetected[2*index])
+		isLeft = true;
+	else if(rand < nDetected[2*index] + nDetected[2*index+1])
+		isLeft = false;
+	else // Photon is not detected
+		return false;
+
+	size_t pmt = 2*index + (isLeft ? 0 : 1);
+
+	// Sample the arrival time
+	size_t tbin = sampleCdf(&timeCdf[pmt*nTimeBins], nTimeBins);
+	dt = (tbin + G4UniformRand())*(tMax/nTimeBins);
+
+	// Sample the hit position on the photo-sensitive surface
+	size_t nPosBins = nPosBinsX*nPosBinsY;
+	size_t pbin = sampleCdf(&posCdf[pmt*nPosBins], nPosBins);
+	double xpos = ((pbin / nPosBinsY) + G4UniformRand())*(faceWidth/nPosBinsX) - faceWidth/2;
+	double ypos = ((pbin % nPosBinsY) + G4UniformRand())*(faceHeight/nPosBinsY) - faceHeight/2;
+	hit = G4ThreeVector(xpos, ypos, hitSumZ[pmt]/nDetected[pmt]);
+
+	return true;
+}
+
+void nDetLightMap::finalize(){
+	timeCdf = timeHist;
+	posCdf = posHist;
+
+	// Compute the running sums of each distribution
+	size_t nPosBins = nPosBinsX*nPosBinsY;
+	for(size_t pmt = 0; pmt < 2*nVoxels; pmt++){
+		float *tptr = &timeCdf[pmt*nTimeBins];
+		for(short i = 1; i < nTimeBins; i++)
+			tptr[i] += tptr[i-1];
+		float *pptr = &posCdf[pmt*nPosBins];
+		for(size_t i = 1; i < nPosBins; i++)
+			pptr[i] += pptr[i-1];
+	}
+}
+
+bool nDetLightMap::write(TFile *f, const std::string &name) const {
+	if(!f || !f->IsOpen() || empty())
+		return false;
+
+	f->cd();
+
+	// Write the layout of the map
+	TTree *layout = new TTree((name+"_layout").c_str(), "Light map layout");
+	short bins[6] = {nBinsX, nBinsY, nBinsZ, nTimeBins, nPosBinsX, nPosBinsY};
+	double dims[6] = {size.getX(), size.getY(), size.getZ(), faceWidth, faceHeight, tMax};
+	layout->Branch("bins", bins, "bins[6]/S");
+	layout->Branch("dims", dims, "dims[6]/D");
+	layout->Fill();
+	layout->Write();
+
+	// Write the contents of each voxel
+	TTree *tree = new TTree(name.c_str(), "Light map voxels");
+	double gen;
+	double det[2];
+	double sumZ[2];
+	std::vector<float> tvec;
+	std::vector<float> pvec;
+	std::vector<float> *tptr = &tvec;
+	std::vector<float> *pptr = &pvec;
+	tree->Branch("nGen", &gen);
+	tree->Branch("nDet", det, "nDet[2]/D");
+	tree->Branch("sumZ", sumZ, "sumZ[2]/D");
+	tree->Branch("time", &tptr);
+	tree->Branch("pos", &pptr);
+
+	size_t nPosBins = nPosBinsX*nPosBinsY;
+	for(size_t index = 0; index < nVoxels; index++){
+		gen = nGenerated[index];
+		det[0] = nDetected[2*index];
+		det[1] = nDetected[2*index+1];
+		sumZ[0] = hitSumZ[2*index];
+		sumZ[1] = hitSumZ[2*index+1];
+		tvec.assign(timeHist.begin()+2*index*nTimeBins, timeHist.begin()+2*(index+1)*nTimeBins);
+		pvec.assign(posHist.begin()+2*index*nPosBins, posHist.begin()+2*(index+1)*nPosBins);
+		tree->Fill();
+	}
+	tree->Write();
+
+	delete layout;
+	delete tree;
+
+	return true;
+}
+
+bool nDetLightMap::read(TFile *f, const std::string &name){
+	if(!f || !f->IsOpen())
+		return false;
+
+	TTree *layout = (TTree*)f->Get((name+"_layout").c_str());
+	TTree *tree = (TTree*)f->Get(name.c_str());
+	if(!layout || !tree){
+		Display::ErrorPrint("Failed to find light map \""+name+"\" in input file!", "nDetLightMap");
+		return false;
+	}
+
+	// Read the layout of the map
+	short bins[6];
+	double dims[6];
+	layout->SetBranchAddress("bins", bins);
+	layout->SetBranchAddress("dims", dims);
+	layout->GetEntry(0);
+
+	setNumVoxels(bins[0], bins[1], bins[2]);
+	setTimeBins(bins[3], dims[5]);
+	setPositionBins(bins[4], bins[5]);
+	if(!initialize(G4ThreeVector(dims[0], dims[1], dims[2]), dims[3], dims[4]))
+		return false;
+
+	if((size_t)tree->GetEntries() != nVoxels){
+		Display::ErrorPrint("Light map \""+name+"\" contains an unexpected number of voxels!", "nDetLightMap");
+		nVoxels = 0;
+		return false;
+	}
+
+	// Read the contents of each voxel
+	double gen;
+	double det[2];
+	double sumZ[2];
+	std::vector<float> *tptr = NULL;
+	std::vector<float> *pptr = NULL;
+	tree->SetBranchAddress("nGen", &gen);
+	tree->SetBranchAddress("nDet", det);
+	tree->SetBranchAddress("sumZ", sumZ);
+	tree->SetBranchAddress("time", &tptr);
+	tree->SetBranchAddress("pos", &pptr);
+
+	size_t nPosBins = nPosBinsX*nPosBinsY;
+	for(size_t index = 0; index < nVoxels; index++){
+		tree->GetEntry(index);
+		if(tptr->size() != 2*(size_t)nTimeBins || pptr->size() != 2*nPosBins){
+			Display::ErrorPrint("Light map \""+name+"\" contains malformed voxel data!", "nDetLightMap");
+			nVoxels = 0;
+			return false;
+		}
+		nGenerated[index] = gen;
+		nDetected[2*index] = det[0];
+		nDetected[2*index+1] = det[1];
+		hitSumZ[2*index] = sumZ[0];
+		hitSumZ[2*index+1] = sumZ[1];
+		std::copy(tptr->begin(), tptr->end(), timeHist.begin()+2*index*nTimeBins);
+		std::copy(pptr->begin(), pptr->end(), posHist.begin()+2*index*nPosBins);
+	}
+
+	tree->ResetBranchAddresses();
+	delete tptr;
+	delete pptr;
+
+	finalize();
+
+	return true;
+}
+
+void nDetLightMap::print() const {
+	std::cout << "  Voxels    : " << nBinsX << " x " << nBinsY << " x " << nBinsZ << " (" << nVoxels << " total)\n";
+	std::cout << "  Size      : " << size.getX() << " x " << size.getY() << " x " << size.getZ() << " mm^3\n";
+	std::cout << "  Time bins : " << nTimeBins << " (tmax=" << tMax << " ns)\n";
+	std::cout << "  Pos bins  : " << nPosBinsX << " x " << nPosBinsY << std::endl;
+	if(!empty()){
+		double total = getNumGenerated();
+		std::cout << "  Generated : " << total << std::endl;
+		std::cout << "  DetectedL : " << getNumDetected(true) << std::endl;
+		std::cout << "  DetectedR : " << getNumDetected(false) << std::endl;
+	}
+}
+
+size_t nDetLightMap::sampleCdf(const float *cdf, const size_t &N) const {
+	float rand = G4UniformRand()*cdf[N-1];
+	const float *bin = std::upper_bound(cdf, cdf+N, rand);
+	return std::min((size_t)(bin-cdf), N-1);
+}
@@ -1,13 +1,18 @@
 #include <vector>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
 
 #include "G4Run.hh"
 #include "G4Timer.hh"
+#include "G4Threading.hh"
 #include "G4MTRunManager.hh"
 #include "G4UserRunAction.hh"
 
+#include "TROOT.h"
 #include "TFile.h"
 #include "TTree.h"
+#include "TChain.h"
 
 #include "nDetParticleSource.hh"
 #include "nDetParticleSourceMessenger.hh"
@@ -42,6 +47,19 @@ nDetMasterOutputFile::nDetMasterOutputFile(){
 	fFile = NULL;
 	fTree = NULL;
 
+	outputShardMode = SINGLE;
+
+	writerThread = NULL;
+	writerQueueSize = 0;
+	queueHead = 0;
+	queueDepth = 0;
+	buffersInUse = 0;
+	stopWriter = false;
+	maxQueueDepth = 0;
+	numQueued = 0;
+	sumQueueDepth = 0;
+	numStalls = 0;
+
 	runTitle = "NEXT Geant4 output";
 	runIndex = 1;
 
@@ -62,11 +80,17 @@ nDetMasterOutputFile::nDetMasterOutputFile(){
 	multData = new nDetMultiOutputStructure();
 	debugData = new nDetDebugStructure();
 	traceData = new nDetTraceStructure();
+
+	treeData.setDataAddresses(evtData, outData, multData, debugData, traceData);
 }
 
 nDetMasterOutputFile::~nDetMasterOutputFile(){
 	// Close the root file, if it's still open.
 	closeRootFile();
+
+	// Delete all recycled event buffers.
+	for(auto buffer : bufferPool)
+		delete buffer;
 	
 	delete evtData;
 	delete outData;
@@ -155,21 +179,22 @@ bool nDetMasterOutputFile::openRootFile(const G4Run* aRun){
 	else
 		Display::WarningPrint("Failed to find master run manager.", "nDetMasterOutputFile");
 
+	// Record the quantum efficiency pre-culling mode in use. When culling is active, the detected photon counts
+	// only include photons which survived culling while the total number of photons includes all photons
+	dir->cd();
+	TNamed culling("qeCullingActive", nDetConstruction::getInstance().GetQuantumEfficiencyCullingString().c_str());
+	culling.Write();
+
 	// Create root tree.
 	if(treename.empty()) treename = "data"; //"neutronEvent";
-	fTree = new TTree(treename.c_str(), "Primary particle scattering data");
-
-	// Add the branches
-	fTree->Branch("event", evtData);
-	if(singleDetectorMode){ // Add the single-detector branches
-		fTree->Branch("output", outData);
-		if(outputDebug) // Add the debug branch
-			fTree->Branch("debug", debugData);
+	if(outputShardMode == SINGLE || !openShards()){
+		fFile->cd();
+		fTree = new TTree(treename.c_str(), "Primary particle scattering data");
+		treeData.setDataAddresses(evtData, outData, multData, debugData, traceData);
+		treeData.setBranches(fTree, singleDetectorMode, outputDebug, outputTraces);
+		if(writerQueueSize > 0) // Start the asynchronous writer
+			startWriter();
 	}
-	else // Add the multiple-detector branch
-		fTree->Branch("output", multData);
-	if(outputTraces) // Add the trace branch
-		fTree->Branch("trace", traceData);
 
 	std::cout << "nDetMasterOutputFile: File " << fFile->GetName() << " opened." << std::endl;
 	
@@ -182,11 +207,18 @@ bool nDetMasterOutputFile::openRootFile(const G4Run* aRun){
 bool nDetMasterOutputFile::closeRootFile(){
 	// Close the root file.
 	if(fFile){
+		stopWriterThread();
+		closeShards();
 		fFile->cd();
-		fTree->Write();
+		if(fTree)
+			fTree->Write();
 		fFile->Close();
 		delete fFile;
 		fFile = NULL;
+		fTree = NULL;
+		
+		// Do not leave the tree pointing to thread data
+		treeData.setDataAddresses(evtData, outData, multData, debugData, traceData);
 	}
 	return true;
 }
@@ -195,52 +227,109 @@ void nDetMasterOutputFile::printMessage(const G4String &msg) const {
 	Display::InfoPrint(msg);
 }
 
+bool nDetMasterOutputFile::setShardMode(const std::string &mode){
+	if(mode == "false" || mode == "single")
+		outputShardMode = SINGLE;
+	else if(mode == "merge" || mode == "true")
+		outputShardMode = MERGE;
+	else if(mode == "chain")
+		outputShardMode = CHAIN;
+	else{
+		Display::ErrorPrint("Unrecognized per-thread output mode ("+mode+")!", "nDetMasterOutputFile");
+		return false;
+	}
+	return true;
+}
+
 bool nDetMasterOutputFile::fillBranch(const nDetDataPack &pack){
 	if(!outputEnabled) return false;
 
+	if(!shards.empty()){ // Per-thread output. Each thread owns its file, so no lock is required
+		int threadID = G4Threading::G4GetThreadId();
+		if(threadID >= 0 && threadID < (int)shards.size()){
+			outputShard *shard = shards.at(threadID);
+			
+			if(outputBadEvents || pack.goodEvent()){
+				shard->data = pack; // Point the branches at the data of this thread
+				shard->tree->Fill(); // Fill the tree
+			}
+
+			// Status output.
+			updateStatus(pack.getEventID());
+			return true;
+		}
+	}
+
+	if(writerThread){ // Asynchronous output. The writer thread will fill the tree
+		if(outputBadEvents || pack.goodEvent()) // Discarded events never take a buffer
+			pushEvent(pack);
+		else
+			updateStatus(pack.getEventID());
+		return true;
+	}
+
 	// Enable the mutex lock to protect file access.
 	fileLock.lock();
 
-	// Copy the data
-	pack.copyData(evtData, outData, multData, debugData, traceData);
-
-	if(outputBadEvents || pack.goodEvent())
+	if(outputBadEvents || pack.goodEvent()){
+		treeData = pack; // Point the branches at the data of the calling thread
 		fTree->Fill(); // Fill the tree
+	}
+
+	// Status output.
+	if(pack.getEventID() != 0)
+		printStatus(pack.getEventID());
+	else // Start the timer.
+		timer->Start();
+
+	// Disable the mutex lock to open access to the file.
+	fileLock.unlock();
+
+	return true;
+}
+
+void nDetMasterOutputFile::updateStatus(const int &eventID){
+	if(eventID != 0){ // Skip the status output if another thread is already updating the status
+		if(fileLock.try_lock()){
+			printStatus(eventID);
+			fileLock.unlock();
+		}
+	}
+	else{ // Start the timer.
+		fileLock.lock();
+		timer->Start();
+		fileLock.unlock();
+	}
+}
 
+void nDetMasterOutputFile::printStatus(const int &eventID){
 	double avgTimePerEvent;
 	double avgTimePerPhoton;
 	double avgTimePerDetection;
 
-	if(pack.getEventID() != 0){ // Status output.
-		timer->Stop();
-		nDetThreadContainer *container = &nDetThreadContainer::getInstance();
-		unsigned long long numPhotons = 0;
-		unsigned long long numPhotonsDet = 0;
-		for(size_t index = 0; index < container->size(); index++){
-			numPhotons += container->getActionManager(index)->getRunAction()->getNumPhotons();
-			numPhotonsDet += container->getActionManager(index)->getRunAction()->getNumPhotonsDet();
-		}
-		totalTime += timer->GetRealElapsed();
-		if(displayTimeInterval > 0 && (totalTime - previousTime) >= displayTimeInterval){ // Display every 10 seconds.
-			std::cout << "Event ID: " << pack.getEventID() << ", TIME=" << totalTime << " s";
-			avgTimePerEvent = totalTime/pack.getEventID();
-			avgTimePerPhoton = totalTime/numPhotons;
-			avgTimePerDetection = totalTime/numPhotonsDet;
-			if(totalEvents > 0){
-				std::cout << ", REMAINING=" << (totalEvents-pack.getEventID())*avgTimePerEvent << " s";
-			}
-			std::cout << ", RATE=" << 1/avgTimePerEvent << " evt/s (" << 1/avgTimePerPhoton << " phot/s & " << 1/avgTimePerDetection << " det/s)\n";
-			previousTime = totalTime;
+	timer->Stop();
+	nDetThreadContainer *container = &nDetThreadContainer::getInstance();
+	unsigned long long numPhotons = 0;
+	unsigned long long numPhotonsDet = 0;
+	for(size_t index = 0; index < container->size(); index++){
+		numPhotons += container->getActionManager(index)->getRunAction()->getNumPhotons();
+		numPhotonsDet += container->getActionManager(index)->getRunAction()->getNumPhotonsDet();
+	}
+	totalTime += timer->GetRealElapsed();
+	if(displayTimeInterval > 0 && (totalTime - previousTime) >= displayTimeInterval){ // Display every 10 seconds.
+		std::cout << "Event ID: " << eventID << ", TIME=" << totalTime << " s";
+		avgTimePerEvent = totalTime/eventID;
+		avgTimePerPhoton = totalTime/numPhotons;
+		avgTimePerDetection = totalTime/numPhotonsDet;
+		if(totalEvents > 0){
+			std::cout << ", REMAINING=" << (totalEvents-eventID)*avgTimePerEvent << " s";
 		}
+		std::cout << ", RATE=" << 1/avgTimePerEvent << " evt/s (" << 1/avgTimePerPhoton << " phot/s & " << 1/avgTimePerDetection << " det/s)\n";
+		previousTime = totalTime;
 	}
 
 	// Start the timer.
 	timer->Start();
-
-	// Disable the mutex lock to open access to the file.
-	fileLock.unlock();
-
-	return true;
 }
 
 void nDetMasterOutputFile::setOutputFilename(const std::string &fname){
@@ -290,3 +379,204 @@ void nDetMasterOutputFile::writeMessengerCommands(messengerHandler* messenger, T
 		named.Write();
 	}
 }
+
+bool nDetMasterOutputFile::openShards(){
+	int numThreads = 0;
+#ifdef USE_MULTITHREAD
+	if(G4MTRunManager::GetMasterRunManager())
+		numThreads = G4MTRunManager::GetMasterRunManager()->GetNumberOfThreads();
+#endif
+	if(numThreads <= 0) // Sequential mode. Use the single output file.
+		return false;
+
+	// Each thread will be writing to its own file concurrently.
+	ROOT::EnableThreadSafety();
+
+	// Per-thread files are named PREFIX-threadN.root
+	std::string prefix = fFile->GetName();
+	size_t index = prefix.find_last_of('.');
+	if(index != std::string::npos)
+		prefix = prefix.substr(0, index);
+	
+	for(int i = 0; i < numThreads; i++){
+		std::stringstream stream;
+		stream << prefix << "-thread" << i << ".root";
+		outputShard *shard = new outputShard();
+		shard->file = new TFile(stream.str().c_str(), "RECREATE", runTitle.c_str());
+		if(!shard->file->IsOpen()){
+			Display::ErrorPrint("Failed to open per-thread output file \""+stream.str()+"\"!", "nDetMasterOutputFile");
+			delete shard->file;
+			delete shard;
+			closeShards();
+			return false;
+		}
+		shard->file->cd();
+		shard->tree = new TTree(treename.c_str(), "Primary particle scattering data");
+		shard->data.setDataAddresses(evtData, outData, multData, debugData, traceData); // Re-pointed at the thread data on each fill
+		shard->data.setBranches(shard->tree, singleDetectorMode, outputDebug, outputTraces);
+		shards.push_back(shard);
+	}
+
+	if(verbose)
+		std::cout << "nDetMasterOutputFile: Opened " << numThreads << " per-thread output files.\n";
+
+	fFile->cd();
+
+	return true;
+}
+
+void nDetMasterOutputFile::closeShards(){
+	if(shards.empty()) return;
+
+	// Close all per-thread files.
+	std::vector<std::string> shardFilenames;
+	std::vector<Long64_t> shardEntries;
+	for(auto shard : shards){
+		shardFilenames.push_back(shard->file->GetName());
+		shardEntries.push_back(shard->tree->GetEntries());
+		shard->file->cd();
+		shard->tree->Write();
+		shard->file->Close();
+		delete shard->file;
+		delete shard;
+	}
+	shards.clear();
+
+	if(!fFile || !fFile->IsOpen()) return;
+
+	TChain chain(treename.c_str());
+	for(auto fname : shardFilenames)
+		chain.Add(fname.c_str());
+
+	fFile->cd();
+	if(outputShardMode == CHAIN){ // Write a chain of all files and an index of the entries in each file
+		chain.Write();
+		
+		int thread;
+		Long64_t entries;
+		Long64_t firstEntry = 0;
+		TTree *shardIndex = new TTree("shards", "Per-thread output file index");
+		shardIndex->Branch("thread", &thread);
+		shardIndex->Branch("entries", &entries);
+		shardIndex->Branch("firstEntry", &firstEntry);
+		for(size_t i = 0; i < shardEntries.size(); i++){
+			thread = (int)i;
+			entries = shardEntries.at(i);
+			shardIndex->Fill();
+			firstEntry += entries;
+		}
+		shardIndex->Write();
+		delete shardIndex;
+	}
+	else{ // Merge all per-thread trees into the output file and remove the per-thread files
+		if(chain.Merge(fFile, 0, "fast keep") >= 0){
+			for(auto fname : shardFilenames)
+				std::remove(fname.c_str());
+		}
+		else
+			Display::ErrorPrint("Failed to merge per-thread output files!", "nDetMasterOutputFile");
+	}
+}
+
+void nDetMasterOutputFile::startWriter(){
+	// The output tree will be filled from the writer thread.
+	ROOT::EnableThreadSafety();
+
+	writerQueue.assign(writerQueueSize, NULL);
+	queueHead = 0;
+	queueDepth = 0;
+	stopWriter = false;
+
+	// Reset the queue statistics.
+	maxQueueDepth = 0;
+	numQueued = 0;
+	sumQueueDepth = 0;
+	numStalls = 0;
+
+	writerThread = new std::thread(&nDetMasterOutputFile::writerLoop, this);
+}
+
+void nDetMasterOutputFile::stopWriterThread(){
+	if(!writerThread) return;
+
+	// Tell the writer to exit once the queue is empty.
+	{
+		std::lock_guard<std::mutex> lock(queueLock);
+		stopWriter = true;
+	}
+	queueNotEmpty.notify_all();
+	writerThread->join();
+	delete writerThread;
+	writerThread = NULL;
+
+	if(numQueued > 0){
+		std::cout << "nDetMasterOutputFile: Writer queue processed " << numQueued << " events, max depth=" << maxQueueDepth << "/" << writerQueueSize;
+		std::cout << ", average depth=" << (double)sumQueueDepth/numQueued << ", stalls=" << numStalls << std::endl;
+	}
+}
+
+void nDetMasterOutputFile::writerLoop(){
+	outputBuffer *buffer;
+	while(true){
+		// Wait for the next event.
+		{
+			std::unique_lock<std::mutex> lock(queueLock);
+			queueNotEmpty.wait(lock, [this]{ return (queueDepth > 0 || stopWriter); });
+			if(queueDepth == 0) // The queue is empty and the writer has been stopped
+				break;
+			buffer = writerQueue[queueHead];
+			queueHead = (queueHead+1) % writerQueueSize;
+			queueDepth--;
+		}
+
+		treeData = buffer->data; // Point the branches at the buffer
+		fTree->Fill(); // Fill the tree
+
+		// Status output. Discarded events update the status from the calling thread
+		updateStatus(buffer->eventID);
+
+		// Return the buffer to the pool.
+		{
+			std::lock_guard<std::mutex> lock(queueLock);
+			bufferPool.push_back(buffer);
+			buffersInUse--;
+		}
+		queueNotFull.notify_one();
+	}
+}
+
+void nDetMasterOutputFile::pushEvent(const nDetDataPack &pack){
+	// Get a free buffer from the pool.
+	outputBuffer *buffer;
+	{
+		std::unique_lock<std::mutex> lock(queueLock);
+		if(buffersInUse >= writerQueueSize){ // The queue is full. Wait for the writer
+			numStalls++;
+			queueNotFull.wait(lock, [this]{ return (buffersInUse < writerQueueSize); });
+		}
+		if(!bufferPool.empty()){
+			buffer = bufferPool.back();
+			bufferPool.pop_back();
+		}
+		else // Only allocate new buffers until the queue is full
+			buffer = new outputBuffer();
+		buffersInUse++;
+	}
+
+	// Copy the data (the buffer is owned by this thread until it is pushed onto the queue). Vectors in 
+	// recycled buffers keep their capacity, so this does not allocate once the pool has warmed up
+	buffer->data.copyData(pack);
+	buffer->eventID = pack.getEventID();
+
+	// Push the event onto the queue.
+	{
+		std::lock_guard<std::mutex> lock(queueLock);
+		writerQueue[(queueHead+queueDepth) % writerQueueSize] = buffer;
+		queueDepth++;
+		numQueued++;
+		sumQueueDepth += queueDepth;
+		if(queueDepth > maxQueueDepth)
+			maxQueueDepth = queueDepth;
+	}
+	queueNotEmpty.notify_one();
+}
@@ -50,6 +50,13 @@ void nDetMasterOutputFileMessenger::addAllCommands(){
 	
 	addCommand(new G4UIcmdWithAString("/nDet/output/message", this));
 	addGuidance("Print a status message to stdout");
+
+	addCommand(new G4UIcmdWithAString("/nDet/output/perThread", this));
+	addGuidance("Set the per-thread output mode. Each worker thread writes to its own file which is merged into (merge) or chained from (chain) the output file when it is closed");
+	addCandidates("false merge chain");
+
+	addCommand(new G4UIcmdWithAnInteger("/nDet/output/writerQueue", this));
+	addGuidance("Set the maximum number of events queued for the asynchronous writer thread (0 disables the writer thread)");
 }
 	
 void nDetMasterOutputFileMessenger::SetNewChildValue(G4UIcommand *command, G4String newValue){
@@ -87,4 +94,11 @@ void nDetMasterOutputFileMessenger::SetNewChildValue(G4UIcommand *command, G4Str
 	else if(index == 9){
 		fOutputFile->printMessage(newValue);
 	}
+	else if(index == 10){
+		fOutputFile->setShardMode(newValue);
+	}
+	else if(index == 11){
+		G4int val = command->ConvertToInt(newValue);
+		fOutputFile->setWriterQueueSize(val > 0 ? val : 0);
+	}
 }
@@ -1,7 +1,10 @@
+#include <algorithm>
+
 #include "TFile.h"
 #include "TTree.h"
 
 #include "nDetParticleSource.hh"
+#include "nDetEventSeeder.hh"
 #include "nDetParticleSourceMessenger.hh"
 #include "nDetDetector.hh"
 #include "nDetRunAction.hh"
@@ -19,6 +22,7 @@
 #include "G4Gamma.hh"
 #include "G4OpticalPhoton.hh"
 #include "G4Electron.hh"
+#include "G4Threading.hh"
 #include "Randomize.hh"
 
 const double fwhm2stddev = 1/(2*std::sqrt(2*std::log(2)));
@@ -41,7 +45,7 @@ nDetParticleSource &nDetParticleSource::getInstance(){
 nDetParticleSource::nDetParticleSource(nDetDetector *det/*=NULL*/) : G4GeneralParticleSource(), fSourceMessenger(NULL), unitX(1,0,0), unitY(0,1,0), unitZ(0,0,1),
                                                                      sourceOrigin(0,0,0), beamspotType(0), beamspot(0), beamspot0(0), rot(), targThickness(0),targEnergyLoss(0),
                                                                      targTimeSlope(0), targTimeOffset(0), beamE0(0), useReaction(false), isotropic(false), back2back(false), realIsotropic(false),
-                                                                     particleRxn(NULL), detPos(), detSize(), detRot(), sourceIndex(0), numSources(0), interpolationMethod("Lin")
+                                                                     particleRxn(NULL), detPos(), detSize(), detRot(), sourceIndex(0), numSources(0), interpolationMethod("Lin"), master(NULL)
 {
 	// Set the default particle source.
 	SetNeutronBeam(1.0); // Set a 1 MeV neutron beam by default
@@ -59,10 +63,33 @@ nDetParticleSource::nDetParticleSource(nDetDetector *det/*=NULL*/) : G4GeneralPa
 	fSourceMessenger = new nDetParticleSourceMessenger(this); 
 }
 
+nDetParticleSource::nDetParticleSource(nDetParticleSource *master_) : G4GeneralParticleSource(), fSourceMessenger(NULL), unitX(1,0,0), unitY(0,1,0), unitZ(0,0,1),
+                                                                       sourceOrigin(0,0,0), beamspotType(0), beamspot(0), beamspot0(0), rot(), targThickness(0),targEnergyLoss(0),
+                                                                       targTimeSlope(0), targTimeOffset(0), beamE0(0), useReaction(false), isotropic(false), back2back(false), realIsotropic(false),
+                                                                       particleRxn(NULL), detPos(), detSize(), detRot(), sourceIndex(0), numSources(0), interpolationMethod("Lin"), master(master_)
+{
+	// Do not define any sources here. The single particle sources are shared with the master
+	particleRxn = new Reaction();
+	CopyConfiguration(*master);
+}
+
 nDetParticleSource::~nDetParticleSource(){ 
+	if(master){ // Remove this copy from the master source
+		std::lock_guard<std::mutex> lock(master->copyLock);
+		std::vector<nDetParticleSource*>::iterator iter = std::find(master->threadLocalCopies.begin(), master->threadLocalCopies.end(), this);
+		if(iter != master->threadLocalCopies.end())
+			master->threadLocalCopies.erase(iter);
+	}
 	delete particleRxn;
 }
 
+nDetParticleSource *nDetParticleSource::CreateThreadLocalCopy(){
+	nDetParticleSource *retval = new nDetParticleSource(this);
+	std::lock_guard<std::mutex> lock(copyLock);
+	threadLocalCopies.push_back(retval);
+	return retval;
+}
+
 void nDetParticleSource::SetBeamEnergy(const G4double &energy){
 		GetCurrentSource()->GetEneDist()->SetEnergyDisType("Mono");
 		GetCurrentSource()->GetEneDist()->SetMonoEnergy(energy);
@@ -472,6 +499,41 @@ void nDetParticleSource::UpdateAll(){
 		src->GetPosDist()->SetPosRot1(unitZ); // This is x'
 		src->GetPosDist()->SetPosRot2(unitY); // This is y'
 	}
+
+	// Reconcile the configuration of all thread-local copies
+	std::lock_guard<std::mutex> lock(copyLock);
+	for(auto copy : threadLocalCopies)
+		copy->CopyConfiguration(*this);
+}
+
+void nDetParticleSource::CopyConfiguration(const nDetParticleSource &other){
+	unitX = other.unitX;
+	unitY = other.unitY;
+	unitZ = other.unitZ;
+	sourceOrigin = other.sourceOrigin;
+	beamspotType = other.beamspotType;
+	beamspot = other.beamspot;
+	beamspot0 = other.beamspot0;
+	rot = other.rot;
+	targThickness = other.targThickness;
+	targEnergyLoss = other.targEnergyLoss;
+	targTimeSlope = other.targTimeSlope;
+	targTimeOffset = 0;
+	beamE0 = other.beamE0;
+	useReaction = other.useReaction;
+	isotropic = other.isotropic;
+	back2back = other.back2back;
+	realIsotropic = other.realIsotropic;
+	(*particleRxn) = (*other.particleRxn);
+	detPos = other.detPos;
+	detSize = other.detSize;
+	detRot = other.detRot;
+	interpolationMethod = other.interpolationMethod;
+	allSources = other.allSources;
+	sourceIndex = 0;
+	numSources = other.numSources;
+	b2bEnergy[0] = other.b2bEnergy[0];
+	b2bEnergy[1] = other.b2bEnergy[1];
 }
 
 bool nDetParticleSource::Test(const G4String &str){
@@ -630,9 +692,6 @@ G4ThreeVector nDetParticleSource::sphere2cart(const double &theta, const double
 }
 
 void nDetParticleSource::GeneratePrimaries(G4Event* anEvent){
-	// Enable the mutex lock to protect access
-	generatorLock.lock();
-	
 	GeneratePrimaryVertex(anEvent);
 	if(useReaction || isotropic) // Generate particles psuedo-isotropically
 		generateIsotropic(anEvent->GetPrimaryVertex(0));
@@ -647,9 +706,6 @@ void nDetParticleSource::GeneratePrimaries(G4Event* anEvent){
 		else if(kE == b2bEnergy[1])
 			particle->SetKineticEnergy(b2bEnergy[0]);
 	}
-	
-	// Disable the mutex lock to open access
-	generatorLock.unlock();
 }
 
 G4SingleParticleSource *nDetParticleSource::nextSource(){
@@ -731,11 +787,24 @@ void nDetParticleSource::setBeamProfile(G4SingleParticleSource *src){
 // class nDetPrimaryGeneratorAction
 ///////////////////////////////////////////////////////////////////////////////
 
-nDetPrimaryGeneratorAction::nDetPrimaryGeneratorAction() : G4VUserPrimaryGeneratorAction() { 
-	source = &nDetParticleSource::getInstance();
+nDetPrimaryGeneratorAction::nDetPrimaryGeneratorAction() : G4VUserPrimaryGeneratorAction(), source(NULL), threadLocal(false) { 
+	if(G4Threading::IsWorkerThread()){ // Use a thread-local copy of the source
+		source = nDetParticleSource::getInstance().CreateThreadLocalCopy();
+		threadLocal = true;
+	}
+	else
+		source = &nDetParticleSource::getInstance();
+}
+
+nDetPrimaryGeneratorAction::~nDetPrimaryGeneratorAction(){
+	if(threadLocal)
+		delete source;
 }
 
 void nDetPrimaryGeneratorAction::GeneratePrimaries(G4Event* anEvent){
-	// Generate a primary particle (mutex protected)
+	// Seed the random engine of this thread from the master seed and the global event ID
+	nDetEventSeeder::getInstance().seedEvent(anEvent->GetEventID());
+
+	// Generate a primary particle (no locking required)
 	source->GeneratePrimaries(anEvent);
 }
@@ -0,0 +1,147 @@
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+#include "G4VModularPhysicsList.hh"
+#include "G4SystemOfUnits.hh"
+#include "QGSP_BERT_HP.hh"
+
+#include "G4DecayPhysics.hh"
+#include "G4EmStandardPhysics.hh"
+#include "G4OpticalPhysics.hh"
+
+#include "nDetPhysicsList.hh"
+#include "nDetFastNeutronElastic.hh"
+#include "optionHandler.hh" // split_str
+
+// Maximum depth of nested macro files searched for source commands
+const int maxMacroDepth = 10;
+
+bool nDetPhysicsList::getProfile(const std::string &name, physicsProfile &profile){
+	if(name == "optical")
+		profile = OPTICAL;
+	else if(name == "em")
+		profile = EM;
+	else if(name == "full")
+		profile = FULL;
+	else if(name == "fast")
+		profile = FAST;
+	else
+		return false;
+	return true;
+}
+
+nDetPhysicsList::physicsProfile nDetPhysicsList::getProfileFromMacro(const std::string &filename){
+	physicsProfile profile = FULL;
+	searchMacro(filename, profile);
+	return profile;
+}
+
+std::string nDetPhysicsList::getProfileName(const physicsProfile &profile){
+	switch(profile){
+		case OPTICAL:
+			return "optical";
+		case EM:
+			return "em";
+		case FAST:
+			return "fast";
+		default:
+			break;
+	}
+	return "full";
+}
+
+std::string nDetPhysicsList::getPhysicsListName(const physicsProfile &profile){
+	switch(profile){
+		case OPTICAL:
+			return "G4DecayPhysics+G4OpticalPhysics";
+		case EM:
+			return "G4EmStandardPhysics+G4DecayPhysics+G4OpticalPhysics";
+		case FAST:
+			return "QGSP_BERT_HP+G4OpticalPhysics+nDetFastNeutronPhysics";
+		default:
+			break;
+	}
+	return "QGSP_BERT_HP+G4OpticalPhysics";
+}
+
+G4VModularPhysicsList *nDetPhysicsList::build(const physicsProfile &profile){
+	G4VModularPhysicsList *physics;
+	if(profile == FULL || profile == FAST){
+		physics = new QGSP_BERT_HP();
+	}
+	else{
+		physics = new G4VModularPhysicsList();
+		physics->SetDefaultCutValue(0.7*mm); // Same as QGSP_BERT_HP
+
+		// Decay physics defines all particles, so that sources may use any particle
+		physics->RegisterPhysics(new G4DecayPhysics());
+		if(profile == EM)
+			physics->RegisterPhysics(new G4EmStandardPhysics());
+	}
+
+	G4OpticalPhysics *theOpticalPhysics = new G4OpticalPhysics();
+	theOpticalPhysics->SetScintillationByParticleType(true);
+	if(profile == FULL || profile == FAST) // Replace the default optical physics of the reference list
+		physics->ReplacePhysics(theOpticalPhysics);
+	else
+		physics->RegisterPhysics(theOpticalPhysics);
+
+	// Fast elastic scattering must be added after the hadron elastic physics
+	if(profile == FAST)
+		physics->RegisterPhysics(new nDetFastNeutronPhysics());
+
+	return physics;
+}
+
+bool nDetPhysicsList::searchMacro(const std::string &filename, physicsProfile &profile, const int &depth/*=0*/){
+	if(depth > maxMacroDepth)
+		return false;
+
+	std::ifstream macro(filename.c_str());
+	if(!macro.good())
+		return false;
+
+	bool found = false;
+	std::string line;
+	std::vector<std::string> args;
+	while(std::getline(macro, line)){
+		if(!line.empty() && line[line.length()-1] == '\r')
+			line.erase(line.length()-1);
+		size_t nArgs = split_str(line, args);
+		if(nArgs < 1 || args.front()[0] == '#')
+			continue;
+		if(args.at(0) == "/control/execute"){
+			if(nArgs >= 2)
+				found = searchMacro(args.at(1), profile, depth+1) || found;
+		}
+		else if(args.at(0) == "/nDet/source/type" && nArgs >= 2){
+			const std::string &type = args.at(1);
+			if(type == "laser")
+				profile = OPTICAL;
+			else if(type == "137Cs" || type == "60Co" || type == "133Ba" || type == "241Am" || type == "90Sr" || type == "gamma" || type == "electron")
+				profile = EM;
+			else // Neutron sources
+				profile = FULL;
+			found = true;
+		}
+		else if(args.at(0) == "/nDet/source/addLevel"){ // Levels are added to the current source
+			if(nArgs < 4 || args.at(3) == "gamma" || args.at(3) == "electron")
+				profile = std::max(profile, EM);
+			else // Neutron levels
+				profile = FULL;
+			found = true;
+		}
+		else if(args.at(0) == "/nDet/source/reaction" || args.at(0) == "/nDet/source/edist" || args.at(0) == "/nDet/source/reset"){
+			// Reactions may produce neutrons, and the particles of the other sources are unknown
+			profile = FULL;
+			found = true;
+		}
+		else if(args.at(0).find("/gps/") == 0 || args.at(0).find("/gun/") == 0){ // Sources which are not handled by NEXTSim
+			profile = FULL;
+			found = true;
+		}
+	}
+
+	return found;
+}
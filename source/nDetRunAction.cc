@@ -1,4 +1,5 @@
 #include "time.h"
+#include <algorithm>
 
 #include "Randomize.hh"
 #include "G4Timer.hh"
@@ -10,21 +11,29 @@
 #include "nDetEventAction.hh"
 #include "nDetStackingAction.hh"
 #include "nDetTrackingAction.hh"
-#include "nDetSteppingAction.hh"
 #include "nDetParticleSource.hh"
+#include "nDetEventSeeder.hh"
 #include "nDetMasterOutputFile.hh"
 #include "termColors.hh"
 
 const double KINETIC_ENERGY_THRESHOLD = 0.001; // MeV
 
+const double coeff = 1.23984193E-3; // hc = Mev * nm
+
 /// Returns the dot product of two vectors i.e. v1 * v2
 double dotProduct(const G4ThreeVector &v1, const G4ThreeVector &v2){
 	return (v1.getX()*v2.getX() + v1.getY()*v2.getY() + v1.getZ()*v2.getZ());
 }
 
+copyNumberEntry::copyNumberEntry(nDetDetector *det_, const size_t &index_) : det(det_), detID(det_->getParentCopyNumber()), index(index_), col(0), row(0), isLeft(false) {
+	// local = R*(global - pos) = R*global - R*pos
+	rotation = *det->getRotation();
+	offset = -(rotation*(*det->getPosition()));
+}
+
 primaryTrackInfo::primaryTrackInfo(const G4Step *step){
 	this->setValues(step->GetTrack());
-	if(step->GetPreStepPoint()->GetPhysicalVolume()->GetName().find("Scint") != std::string::npos) // Scatter event occured inside a scintillator.
+	if(nDetConstruction::getInstance().GetVolumeRole(step->GetPreStepPoint()->GetPhysicalVolume()) == nDetConstruction::SCINTILLATOR) // Scatter event occured inside a scintillator.
 		inScint = true;
 	dkE = -1*(step->GetPostStepPoint()->GetKineticEnergy()-step->GetPreStepPoint()->GetKineticEnergy());
 }
@@ -83,13 +92,14 @@ nDetRunAction::nDetRunAction(){
 	eventAction = NULL;
 	stacking = NULL;
 	tracking = NULL;
-	stepping = NULL;
 	
 	// Set the particle source.
 	source = &nDetParticleSource::getInstance();
 
 	numPhotonsTotal = 0;
 	numPhotonsDetTotal = 0;
+	numEventsVetoed = 0;
+	std::fill(numPhotonsCut, numPhotonsCut+NUM_PHOTON_CUTS, 0);
 	
 	// Pointer to the start detector (if available)
 	startDetector = NULL;
@@ -109,16 +119,40 @@ void nDetRunAction::BeginOfRunAction(const G4Run* aRun)
 {
 	numPhotonsTotal = 0;
 	numPhotonsDetTotal = 0;
-
+	numEventsVetoed = 0;
+	std::fill(numPhotonsCut, numPhotonsCut+NUM_PHOTON_CUTS, 0);
+	
 	// Get RunId and threadID
 	evtData.runNb = aRun->GetRunID();
 	evtData.threadID = G4Threading::G4GetThreadId();
 
-	if(G4Threading::G4GetThreadId() >= 0) return; // Master thread only.
+	if(G4Threading::G4GetThreadId() >= 0){ // Worker threads. Everything below is for the master thread only.
+		setupQuantumEfficiencyCulling();
+		return;
+	}
 
-	// Update the source. Only need to do this once since it's a singleton
+	// Update the master source. This also updates all thread-local copies used by the worker threads
 	source->UpdateAll();
 
+	// Compute the global ID of the first event of this run (for per-event seeding)
+	nDetEventSeeder::getInstance().beginRun(aRun->GetRunID(), aRun->GetNumberOfEventToBeProcessed());
+
+	// Store the physics tables in the cache (if enabled and not retrieved from it)
+	detector->StorePhysicsCache();
+
+	// Setup the optical photon light maps (if enabled)
+	detector->InitializeLightMaps();
+
+	// Compute the optical photon time cut (if enabled)
+	detector->InitializePhotonCuts();
+
+	// Setup the kill mode for particles leaving the detectors (if enabled)
+	detector->InitializeKillMode();
+
+	// Setup optical photon quantum efficiency pre-culling (if enabled)
+	detector->InitializeQuantumEfficiencyCulling();
+	setupQuantumEfficiencyCulling();
+
 	G4cout << "nDetRunAction::BeginOfRunAction()->"<< G4endl;
 	G4cout << "### Run " << aRun->GetRunID() << " start." << G4endl; 
 	timer->Start();
@@ -163,6 +197,30 @@ void nDetRunAction::EndOfRunAction(const G4Run* aRun)
 	
 	timer->Stop();
 	G4cout << "number of event = " << aRun->GetNumberOfEvent() << " " << *timer << G4endl;
+
+	// Write the optical photon light maps (building mode only)
+	if(detector->GetLightMapMode() == nDetLightMap::BUILD)
+		detector->WriteLightMaps();
+
+	// Print the number of optical photons removed by each cut
+	if(detector->GetPhotonCutsEnabled()){
+		nDetThreadContainer *container = &nDetThreadContainer::getInstance();
+		unsigned long long numCut[NUM_PHOTON_CUTS] = {0};
+		for(size_t index = 0; index < container->size(); index++){
+			for(int cut = 0; cut < NUM_PHOTON_CUTS; cut++)
+				numCut[cut] += container->getActionManager(index)->getRunAction()->getNumPhotonsCut((photonCut)cut);
+		}
+		G4cout << "optical photons cut: time = " << numCut[TIME_CUT] << ", track length = " << numCut[LENGTH_CUT] << ", reflections = " << numCut[REFLECTION_CUT] << ", outside detectors = " << numCut[OUTSIDE_CUT] << G4endl;
+	}
+
+	// Print the number of events which failed the optical trigger
+	if(getDeferOpticalPhotons()){
+		nDetThreadContainer *container = &nDetThreadContainer::getInstance();
+		unsigned long long numVetoed = 0;
+		for(size_t index = 0; index < container->size(); index++)
+			numVetoed += container->getActionManager(index)->getRunAction()->getNumEventsVetoed();
+		G4cout << "events failing optical trigger = " << numVetoed << G4endl;
+	}
 }
 
 void nDetRunAction::updateDetector(nDetConstruction *construction){
@@ -172,6 +230,11 @@ void nDetRunAction::updateDetector(nDetConstruction *construction){
 	// Copy the list of detectors
 	construction->GetCopiesOfDetectors(userDetectors);	
 	
+	// Reset the list of hit detectors
+	hitDetectors.clear();
+	hitDetectors.reserve(userDetectors.size());
+	detectorHit.assign(userDetectors.size(), false);
+
 	// Search for a start detector. Currently only one start is supported, break after finding the first one
 	startDetector = NULL;
 	for(std::vector<nDetDetector>::iterator iter = userDetectors.begin(); iter != userDetectors.end(); iter++){
@@ -180,22 +243,48 @@ void nDetRunAction::updateDetector(nDetConstruction *construction){
 			 break;
 		}
 	}
+
+	// Build the copy number lookup tables. PMT, segment, and assembly copy numbers overlap, so they use separate tables
+	pmtLookup.clear();
+	segmentLookup.clear();
+	assemblyLookup.clear();
+	for(std::vector<nDetDetector>::iterator iter = userDetectors.begin(); iter != userDetectors.end(); iter++){
+		copyNumberEntry entry(&(*iter), iter-userDetectors.begin());
+		
+		// Detector assembly
+		if(iter->getParentCopyNumber() >= (G4int)assemblyLookup.size())
+			assemblyLookup.resize(iter->getParentCopyNumber()+1);
+		assemblyLookup[iter->getParentCopyNumber()] = entry;
+
+		// Left and right PMTs
+		if(iter->getRightPmtCopyNumber() >= (G4int)pmtLookup.size())
+			pmtLookup.resize(iter->getRightPmtCopyNumber()+1);
+		entry.isLeft = true;
+		pmtLookup[iter->getLeftPmtCopyNumber()] = entry;
+		entry.isLeft = false;
+		pmtLookup[iter->getRightPmtCopyNumber()] = entry;
+		
+		// Scintillator segments
+		if(iter->getLastSegmentCopyNumber() > (G4int)segmentLookup.size())
+			segmentLookup.resize(iter->getLastSegmentCopyNumber());
+		for(G4int copyNum = iter->getFirstSegmentCopyNumber(); copyNum < iter->getLastSegmentCopyNumber(); copyNum++){
+			iter->getSegmentFromCopyNum(copyNum, entry.col, entry.row);
+			segmentLookup[copyNum] = entry;
+		}
+	}
 }
 
 G4int nDetRunAction::checkCopyNumber(const G4int &num) const {
-	for(std::vector<nDetDetector>::const_iterator iter = userDetectors.begin(); iter != userDetectors.end(); iter++){
-		if(iter->checkCopyNumber(num))
-			return iter->getParentCopyNumber();
-	}
-	return -1;
+	const copyNumberEntry *entry = findSegment(num);
+	return (entry ? entry->detID : -1);
 }
 
 bool nDetRunAction::getSegmentFromCopyNum(const G4int &copyNum, G4int &col, G4int &row) const {
-	for(std::vector<nDetDetector>::const_iterator iter = userDetectors.begin(); iter != userDetectors.end(); iter++){
-		if(iter->getSegmentFromCopyNum(copyNum, col, row))
-			return true;
-	}
-	return false;
+	const copyNumberEntry *entry = findSegment(copyNum);
+	if(!entry) return false;
+	col = entry->col;
+	row = entry->row;
+	return true;
 }
 
 bool nDetRunAction::processDetector(nDetDetector* det){
@@ -209,11 +298,15 @@ bool nDetRunAction::processDetector(nDetDetector* det){
 	centerOfMass *cmL = det->getCenterOfMassL();
 	centerOfMass *cmR = det->getCenterOfMassR();
 
-	debugData.nPhotons[0] += cmL->getNumDetected();
-	debugData.nPhotons[1] += cmR->getNumDetected();
+	// Use the weighted number of detected photons, in case optical photons were thinned at birth
+	unsigned int nDetectedL = (unsigned int)(cmL->getWeightedNumDetected() + 0.5);
+	unsigned int nDetectedR = (unsigned int)(cmR->getWeightedNumDetected() + 0.5);
+
+	debugData.nPhotons[0] += nDetectedL;
+	debugData.nPhotons[1] += nDetectedR;
 	
 	// Compute the total number of detected photons
-	outData.nPhotonsDet += cmL->getNumDetected() + cmR->getNumDetected();
+	outData.nPhotonsDet += nDetectedL + nDetectedR;
 		
 	// Check for valid bar detection
 	if(cmL->getNumDetected() > 0 && cmR->getNumDetected() > 0)
@@ -251,9 +344,9 @@ bool nDetRunAction::processDetector(nDetDetector* det){
 	pmtL->setAdcLatchTicks(latch);
 	pmtR->setAdcLatchTicks(latch);
 	
-	// "Digitize" the light pulses.
-	pmtL->digitize();
-	pmtR->digitize();
+	// "Digitize" the light pulses of the dynodes and the anodes.
+	cmL->digitize();
+	cmR->digitize();
 	
 	// Check for saturated pulse.
 	if(pmtL->getPulseIsSaturated() || pmtR->getPulseIsSaturated()){
@@ -302,34 +395,34 @@ bool nDetRunAction::processDetector(nDetDetector* det){
 		}
 	}
 	
-	// Get the digitizer response of the anodes.
-	/*pmtResponse *anodeResponseL = cmL->getAnodeResponse();
+	// Get the digitizer response of the anodes (segmented PMTs only).
+	pmtResponse *anodeResponseL = cmL->getAnodeResponse();
 	pmtResponse *anodeResponseR = cmR->getAnodeResponse();
-
-	// Digitize anode waveforms and integrate.
-	float anodeQDC[2][4];
-	for(size_t i = 0; i < 4; i++){
-		anodeResponseL[i].digitize();
-		anodeResponseR[i].digitize();
-		debugData.anodeQDC[0][i] = anodeResponseL[i].integratePulseFromMaximum();
-		debugData.anodeQDC[1][i] = anodeResponseR[i].integratePulseFromMaximum();
-	}	
-	
-	// Compute the anode positions.
-	for(size_t i = 0; i < 2; i++){
-		debugData.reconDetComX[i] = -((anodeQDC[i][0]+anodeQDC[i][1])-(anodeQDC[i][2]+anodeQDC[i][3]))/(anodeQDC[i][0]+anodeQDC[i][1]+anodeQDC[i][2]+anodeQDC[i][3]);
-		debugData.reconDetComY[i] = ((anodeQDC[i][1]+anodeQDC[i][2])-(anodeQDC[i][3]+anodeQDC[i][0]))/(anodeQDC[i][0]+anodeQDC[i][1]+anodeQDC[i][2]+anodeQDC[i][3]);
-	}
-	outData.reconComX = (debugData.reconDetComX[0] + debugData.reconDetComX[1]) / 2;
-	outData.reconComY = (debugData.reconDetComY[0] + debugData.reconDetComY[1]) / 2;*/
+	bool anodeReadout = (cmL->hasAnodeReadout() && cmR->hasAnodeReadout());
 	
-	if(outputDebug){
-		// Perform CFD on digitized anode waveforms.
-		/*for(size_t i = 0; i < 4; i++){
+	if(anodeReadout){
+		// Perform CFD on digitized anode waveforms and integrate them. The CFD also finds the maximum and
+		// the baseline of each waveform, which are used by the integral.
+		for(size_t i = 0; i < 4; i++){
 			debugData.anodePhase[0][i] = anodeResponseL[i].analyzePolyCFD() + targetTimeOffset; // left
 			debugData.anodePhase[1][i] = anodeResponseR[i].analyzePolyCFD() + targetTimeOffset; // right
-		}*/
-
+			debugData.anodeQDC[0][i] = anodeResponseL[i].integratePulseFromMaximum();
+			debugData.anodeQDC[1][i] = anodeResponseR[i].integratePulseFromMaximum();
+		}	
+		
+		// Compute the anode positions.
+		for(size_t i = 0; i < 2; i++){
+			double *anodeQDC = debugData.anodeQDC[i];
+			double anodeSum = anodeQDC[0]+anodeQDC[1]+anodeQDC[2]+anodeQDC[3];
+			if(anodeSum == 0) continue;
+			debugData.reconDetComX[i] = -((anodeQDC[0]+anodeQDC[1])-(anodeQDC[2]+anodeQDC[3]))/anodeSum;
+			debugData.reconDetComY[i] = ((anodeQDC[1]+anodeQDC[2])-(anodeQDC[3]+anodeQDC[0]))/anodeSum;
+		}
+		outData.reconComX = (debugData.reconDetComX[0] + debugData.reconDetComX[1]) / 2;
+		outData.reconComY = (debugData.reconDetComY[0] + debugData.reconDetComY[1]) / 2;
+	}
+	
+	if(outputDebug){
 		G4ThreeVector nCenterMass(debugData.nComX, debugData.nComY, debugData.nComZ);
 		G4ThreeVector nIncidentPos(debugData.nEnterPosX, debugData.nEnterPosY, debugData.nEnterPosZ);
 		G4ThreeVector nExitPos(debugData.nExitPosX, debugData.nExitPosY, debugData.nExitPosZ);
@@ -394,35 +487,35 @@ void nDetRunAction::process(){
 			debugData.photonsProd.push_back(counter->getPhotonCount(i));
 	}
 
-	short detID = 0;
+	// Only detectors which detected photons need to be processed. Sort them so that
+	// multi-detector output is always written in detector order
+	std::sort(hitDetectors.begin(), hitDetectors.end());
+
 	if(!startDetector){ // Un-triggered mode (default)
-		for(std::vector<nDetDetector>::iterator iter = userDetectors.begin(); iter != userDetectors.end(); iter++){
-			if(!processDetector(&(*iter))){ // Skip the start detector because we already processed it
-				detID++;
+		for(std::vector<size_t>::iterator iter = hitDetectors.begin(); iter != hitDetectors.end(); iter++){
+			if(!processDetector(&userDetectors[*iter])) // Skip events with no detected photons
 				continue;
-			}
 			
 			// Push data onto the output branch for multiple detectors
 			if(userDetectors.size() > 1)
-				multData.Append(outData, detID++);
+				multData.Append(outData, (short)(*iter));
 		}
 	}
 	else{ // Start triggered mode
 		double startTime;
 		if(processStartDetector(startDetector, startTime)){ // Check for valid start signal
-			for(std::vector<nDetDetector>::iterator iter = userDetectors.begin(); iter != userDetectors.end(); iter++){
+			for(std::vector<size_t>::iterator iter = hitDetectors.begin(); iter != hitDetectors.end(); iter++){
 				// Skip the start detector because we already processed it
-				if(&(*iter) != startDetector && !processDetector(&(*iter))){ // Skip events with no detected photons
-					detID++;
+				nDetDetector *det = &userDetectors[*iter];
+				if(det != startDetector && !processDetector(det)) // Skip events with no detected photons
 					continue;
-				}
 
 				// Update the time-of-flight of the event
 				outData.barTOF = outData.barTOF - startTime;
 				
 				// Push data onto the output branch for multiple detectors
 				if(userDetectors.size() > 1)
-					multData.Append(outData, detID++);
+					multData.Append(outData, (short)(*iter));
 			}
 		}
 	}
@@ -433,20 +526,24 @@ void nDetRunAction::process(){
 	// Clear all data structures.
 	data.clear();
 
-	// Clear all statistics.
-	for(std::vector<nDetDetector>::iterator iter = userDetectors.begin(); iter != userDetectors.end(); iter++)
-		iter->clear();
+	// Clear the statistics of all detectors which were hit. Untouched detectors are already clear
+	for(std::vector<size_t>::iterator iter = hitDetectors.begin(); iter != hitDetectors.end(); iter++){
+		userDetectors[*iter].clear();
+		detectorHit[*iter] = false;
+	}
+	hitDetectors.clear();
+
+	// Clear the primary particle entry point, so that events where the primary does not enter a scintillator are recognized
+	primaryTracks.clear();
 	
 	if(stacking) stacking->Reset();
 	if(tracking) tracking->Reset();
-	if(stepping) stepping->Reset();
 }
 
 void nDetRunAction::setActions(userActionManager *action){
 	eventAction = action->getEventAction();
 	stacking = action->getStackingAction();
 	tracking = action->getTrackingAction();
-	stepping = action->getSteppingAction();
 
 	// Get the photon counter
 	counter = stacking->GetCounter();
@@ -460,41 +557,125 @@ bool nDetRunAction::AddDetectedPhoton(const G4Step *step, const double &mass/*=1
 	
 	// Find which detector this optical photon is inside.
 	G4int copyNum = step->GetPostStepPoint()->GetTouchable()->GetCopyNumber();
-	bool foundMatch=false, isLeft;
-	G4ThreeVector *detPos;
-	G4RotationMatrix *detRot;
-	centerOfMass *hitDetPmtL;
-	centerOfMass *hitDetPmtR;
-	for(std::vector<nDetDetector>::iterator iter = userDetectors.begin(); iter != userDetectors.end(); iter++){
-		if(iter->checkPmtCopyNumber(copyNum, isLeft)){
-			foundMatch = true;
-			detPos = iter->getPosition();
-			detRot = iter->getRotation();
-			hitDetPmtL = iter->getCenterOfMassL();
-			hitDetPmtR = iter->getCenterOfMassR();
-			break;
-		}
-	}
-	
-	if(!foundMatch){
+	const copyNumberEntry *entry = findPmt(copyNum);
+	if(!entry){
 		Display::WarningPrint("Failed to find matching detector for detected photon?", "nDetRunAction");
 		return false;
 	}
 	
 	double energy = step->GetTrack()->GetTotalEnergy();
 	double time = step->GetPostStepPoint()->GetGlobalTime();
-	G4ThreeVector position = step->GetPostStepPoint()->GetPosition() - (*detPos);
-	position = (*detRot)*position;
+	G4ThreeVector position = entry->toLocal(step->GetPostStepPoint()->GetPosition());
+
+	// Record the detected photon in the light map of the detector
+	if(detector->GetLightMapMode() == nDetLightMap::BUILD){
+		nDetLightMap *map = detector->GetLightMap(entry->detID);
+		if(map){
+			G4ThreeVector birth = entry->toLocal(step->GetTrack()->GetVertexPosition());
+			map->addDetected(birth, entry->isLeft, step->GetPostStepPoint()->GetLocalTime(), position);
+		}
+	}
+	
+	centerOfMass *hitDetPmt = (entry->isLeft ? entry->det->getCenterOfMassL() : entry->det->getCenterOfMassR());
+	if(!acceptCulledPhoton(hitDetPmt, energy))
+		return false;
+	
+	markDetectorHit(entry->index);
+	return hitDetPmt->addPoint(energy, time, position, mass);
+}
+
+const copyNumberEntry *nDetRunAction::findBirthDetector(const G4Track *track) const {
+	// Scintillation and Cerenkov photons are given the touchable of the step which generated them. Primary
+	// tracks have no touchable until they are first stepped
+	const G4VTouchable *touchable = track->GetTouchable();
+	if(!touchable || touchable->GetHistoryDepth() < 2)
+		return NULL;
+
+	// All detector volumes are placed directly inside of the detector assembly. Segment copy numbers are not
+	// used, since the unsegmented scintillators are not numbered and PMT copy numbers overlap with segments
+	const copyNumberEntry *entry = findAssembly(touchable->GetCopyNumber(1));
+	if(!entry || touchable->GetVolume(1)->GetLogicalVolume() != entry->det->getLogicalVolume()) // Not inside of a detector
+		return NULL;
+	
+	return entry;
+}
+
+bool nDetRunAction::AddGeneratedPhoton(const G4Track *track){
+	const copyNumberEntry *entry = findBirthDetector(track);
+	if(!entry) return false;
+
+	nDetLightMap *map = detector->GetLightMap(entry->detID);
+	if(!map) return false;
+	
+	// Convert the birth position to the frame of the detector
+	size_t voxel;
+	G4ThreeVector birth = entry->toLocal(track->GetPosition());
+	if(!map->findVoxel(birth, voxel)) return false;
+	
+	map->addGenerated(birth);
+	return true;
+}
+
+bool nDetRunAction::SampleLightMap(const G4Track *track, const double &mass/*=1*/){
+	const copyNumberEntry *entry = findBirthDetector(track);
+	if(!entry) return false;
+
+	nDetLightMap *map = detector->GetLightMap(entry->detID);
+	if(!map) return false;
 	
-	if(isLeft){
-		if(hitDetPmtL->addPoint(energy, time, position, mass))
-			return true;
+	// Convert the birth position to the frame of the detector
+	size_t voxel;
+	G4ThreeVector birth = entry->toLocal(track->GetPosition());
+	if(!map->findVoxel(birth, voxel)) return false;
+	
+	// Sample the PMT hit (if any) from the light map
+	bool isLeft;
+	double dt;
+	G4ThreeVector hit;
+	if(map->sample(voxel, isLeft, dt, hit)){
+		centerOfMass *hitDetPmt = (isLeft ? entry->det->getCenterOfMassL() : entry->det->getCenterOfMassR());
+		if(acceptCulledPhoton(hitDetPmt, track->GetTotalEnergy())){
+			markDetectorHit(entry->index);
+			hitDetPmt->addPoint(track->GetTotalEnergy(), track->GetGlobalTime()+dt, hit, mass);
+		}
 	}
-	if(hitDetPmtR->addPoint(energy, time, position, mass))
-		return true;
-	return false;
+	return true;
+}
+
+bool nDetRunAction::checkOpticalTrigger() const {
+	if(primaryTracks.empty()) // The primary particle never entered a scintillator
+		return false;
+	
+	// Sum the energy deposited by all primary particle scatters
+	double depEnergy = 0;
+	for(std::vector<primaryTrackInfo>::const_iterator iter = primaryTracks.begin(); iter != primaryTracks.end(); iter++)
+		depEnergy += iter->dkE;
+	
+	return (depEnergy > 0 && depEnergy >= detector->GetOpticalTriggerThreshold());
 }
 
+G4double nDetRunAction::getQuantumEfficiencySurvivalProbability(const G4double &energy) const {
+	return detector->GetQuantumEfficiencySurvivalProbability(coeff/energy);
+}
+
+void nDetRunAction::setupQuantumEfficiencyCulling(){
+	bool culling = getQuantumEfficiencyCulling();
+	for(std::vector<nDetDetector>::iterator iter = userDetectors.begin(); iter != userDetectors.end(); iter++){
+		iter->getPmtResponseL()->setQuantumEfficiencyAppliedAtBirth(culling);
+		iter->getPmtResponseR()->setQuantumEfficiencyAppliedAtBirth(culling);
+	}
+}
+
+bool nDetRunAction::acceptCulledPhoton(centerOfMass *cm, const double &energy) const {
+	nDetConstruction::qeCullingMode mode = detector->GetQuantumEfficiencyCulling();
+	if(mode != nDetConstruction::QE_CULL_MAXIMUM) // Photons surviving wavelength culling have already been accepted
+		return true;
+	
+	// Accept the photon with the conditional probability QE(lambda)/QEmax
+	double wavelength = coeff/energy; // in nm
+	const spectralResponse *spec = cm->getPmtResponse()->getConstSpectralResponse();
+	return (spec && G4UniformRand()*detector->GetQuantumEfficiencySurvivalProbability(wavelength) < spec->eval(wavelength)/100);
+}
 
 bool nDetRunAction::scatterEvent(){
 	if(primaryTracks.size() <= 1)
@@ -548,21 +729,27 @@ bool nDetRunAction::scatterEvent(){
 }
 
 void nDetRunAction::initializeNeutron(const G4Step *step){
-	evtData.nInitEnergy = step->GetPreStepPoint()->GetKineticEnergy();
+	// The entry point is the pre-step point of the first step inside the scintillator
+	const G4StepPoint *preStep = step->GetPreStepPoint();
 	if(outputDebug){
-		debugData.nEnterTime = step->GetTrack()->GetGlobalTime();
-		debugData.nEnterPosX = step->GetPostStepPoint()->GetPosition().getX();
-		debugData.nEnterPosY = step->GetPostStepPoint()->GetPosition().getY();
-		debugData.nEnterPosZ = step->GetPostStepPoint()->GetPosition().getZ();
+		debugData.nEnterTime = preStep->GetGlobalTime();
+		debugData.nEnterPosX = preStep->GetPosition().getX();
+		debugData.nEnterPosY = preStep->GetPosition().getY();
+		debugData.nEnterPosZ = preStep->GetPosition().getZ();
 		debugData.nTimeInMat = 0;
 		debugData.nExitPosX = 0;
 		debugData.nExitPosY = 0;
 		debugData.nExitPosZ = 0;
-		primaryTracks.clear();
-		primaryTracks.push_back(step);
-		prevDirection = primaryTracks.back().dir;
-		prevPosition = primaryTracks.back().pos;
 	}
+	primaryTracks.clear();
+	primaryTracks.push_back(step);
+	primaryTracks.back().pos = preStep->GetPosition();
+	primaryTracks.back().dir = preStep->GetMomentumDirection();
+	primaryTracks.back().kE = preStep->GetKineticEnergy();
+	primaryTracks.back().gtime = preStep->GetGlobalTime();
+	primaryTracks.back().dkE = 0;
+	prevDirection = primaryTracks.back().dir;
+	prevPosition = primaryTracks.back().pos;
 	if(verbose){ 
 		std::cout << "IN: "; primaryTracks.back().print();
 	}
@@ -0,0 +1,58 @@
+#include "G4Step.hh"
+#include "G4RunManager.hh"
+#include "G4OpticalPhoton.hh"
+
+#include "nDetSensitiveDetector.hh"
+#include "nDetConstruction.hh"
+#include "nDetRunAction.hh"
+
+///////////////////////////////////////////////////////////////////////////////
+// class nDetPmtSensitiveDetector
+///////////////////////////////////////////////////////////////////////////////
+
+nDetPmtSensitiveDetector::nDetPmtSensitiveDetector(const G4String &name) : G4VSensitiveDetector(name), runAction(NULL) {
+}
+
+void nDetPmtSensitiveDetector::Initialize(G4HCofThisEvent*){
+	runAction = (nDetRunAction*)G4RunManager::GetRunManager()->GetUserRunAction();
+}
+
+G4bool nDetPmtSensitiveDetector::ProcessHits(G4Step *step, G4TouchableHistory*){
+	G4Track *track = step->GetTrack();
+	if(!runAction || track->GetDefinition() != G4OpticalPhoton::OpticalPhotonDefinition())
+		return false;
+	return runAction->AddDetectedPhoton(step, track->GetWeight());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// class nDetScintSensitiveDetector
+///////////////////////////////////////////////////////////////////////////////
+
+nDetScintSensitiveDetector::nDetScintSensitiveDetector(const G4String &name) : G4VSensitiveDetector(name), runAction(NULL), primaryEntered(false) {
+	construction = &nDetConstruction::getInstance();
+}
+
+void nDetScintSensitiveDetector::Initialize(G4HCofThisEvent*){
+	runAction = (nDetRunAction*)G4RunManager::GetRunManager()->GetUserRunAction();
+	primaryEntered = false;
+}
+
+G4bool nDetScintSensitiveDetector::ProcessHits(G4Step *step, G4TouchableHistory*){
+	G4Track *track = step->GetTrack();
+	if(track->GetTrackID() != 1 || track->GetTrackStatus() != fAlive || !runAction)
+		return false;
+
+	if(!primaryEntered){ // The primary particle is entering a scintillator for the first time
+		runAction->initializeNeutron(step);
+		primaryEntered = true;
+	}
+
+	bool retval = runAction->scatterNeutron(step);
+
+	// Check if the primary is leaving the scintillator
+	const G4StepPoint *postStep = step->GetPostStepPoint();
+	if(track->GetTrackStatus() == fAlive && postStep->GetStepStatus() == fGeomBoundary && construction->GetVolumeRole(postStep->GetPhysicalVolume()) != nDetConstruction::SCINTILLATOR)
+		runAction->finalizeNeutron(step);
+
+	return retval;
+}
@@ -3,7 +3,9 @@
 #include "G4ParticleDefinition.hh"
 #include "G4ParticleTypes.hh"
 #include "G4Track.hh"
+#include "G4StackManager.hh"
 #include "G4ios.hh"
+#include "Randomize.hh"
 
 nDetStackingAction::nDetStackingAction(nDetRunAction* run) : runAct(run) {
 	numPhotonsProduced = 0;
@@ -13,10 +15,56 @@ G4ClassificationOfNewTrack nDetStackingAction::ClassifyNewTrack(const G4Track *
 	if (aTrack->GetDefinition() == G4OpticalPhoton::OpticalPhotonDefinition()) { // Particle is an optical photon
 		numPhotonsProduced++;
 		counter.addPhoton(aTrack->GetParentID());
+		
+		// Kill photons generated outside of the detectors
+		if(runAct->getPhotonOutsideDetectors(aTrack->GetVolume())){
+			runAct->countPhotonCut(nDetRunAction::OUTSIDE_CUT);
+			return fKill;
+		}
+
+		// Kill photons generated after the maximum optical photon time
+		G4double maxTime = runAct->getPhotonMaxTime();
+		if(maxTime > 0 && aTrack->GetGlobalTime() > maxTime){
+			runAct->countPhotonCut(nDetRunAction::TIME_CUT);
+			return fKill;
+		}
+
+		// Quantum efficiency pre-culling. Kill the photon with the probability that it would not be detected by the PMT. Survivors
+		// are not weighted, they are accepted at the PMT with the conditional probability of detection instead
+		if(runAct->getQuantumEfficiencyCulling() && G4UniformRand() >= runAct->getQuantumEfficiencySurvivalProbability(aTrack->GetTotalEnergy()))
+			return fKill;
+		
+		// Russian roulette. Kill the photon with probability 1-p and give the survivors a weight of 1/p
+		G4double survivalProb = runAct->getPhotonSurvivalProbability();
+		if(survivalProb < 1){
+			if(G4UniformRand() >= survivalProb)
+				return fKill;
+			const_cast<G4Track*>(aTrack)->SetWeight(aTrack->GetWeight()/survivalProb);
+		}
+		
+		nDetLightMap::mapMode mode = runAct->getLightMapMode();
+		if(mode == nDetLightMap::FAST){ // Sample PMT hits from the light map instead of tracking the photon
+			if(runAct->SampleLightMap(aTrack, aTrack->GetWeight()))
+				return fKill;
+		}
+		else if(mode == nDetLightMap::BUILD) // Record the birth of the photon for the light map
+			runAct->AddGeneratedPhoton(aTrack);
+		
+		// Track the photon after all other particles (deferred mode)
+		if(runAct->getDeferOpticalPhotons())
+			return fWaiting;
 	}
 	return fUrgent;
 }
 
+void nDetStackingAction::NewStage(){
+	// Only optical photons are placed on the waiting stack, so all other particles have now been tracked
+	if(runAct->getDeferOpticalPhotons() && !runAct->checkOpticalTrigger()){ // Event failed the trigger, do not track the photons
+		stackManager->clear();
+		runAct->countVetoedEvent();
+	}
+}
+
 void nDetStackingAction::Reset(){
 	numPhotonsProduced = 0;
 	counter.clear();
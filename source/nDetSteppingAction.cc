@@ -1,41 +1,75 @@
 #include "G4Step.hh"
-#include "G4ParticleDefinition.hh"
 #include "G4OpticalPhoton.hh"
+#include "G4OpBoundaryProcess.hh"
+#include "G4ProcessManager.hh"
 
 #include "nDetSteppingAction.hh"
 #include "nDetConstruction.hh"
 #include "nDetRunAction.hh"
 
-nDetSteppingAction::nDetSteppingAction(nDetRunAction* runAct) : runAction(runAct) {
-	neutronTrack = false;
+nDetSteppingAction::nDetSteppingAction(nDetRunAction *run) : runAction(run), boundary(NULL), numReflections(0) {
+	construction = &nDetConstruction::getInstance();
 }
 
-nDetSteppingAction::~nDetSteppingAction(){ }
+void nDetSteppingAction::UserSteppingAction(const G4Step *step){
+	G4Track *track = step->GetTrack();
+	if(track->GetTrackStatus() != fAlive)
+		return;
 
-void nDetSteppingAction::UserSteppingAction(const G4Step* aStep){
-	G4Track *track = aStep->GetTrack();
-	if(track->GetDefinition() == G4OpticalPhoton::OpticalPhotonDefinition()){ // Check for detected optical photons.
-		if(aStep->GetPostStepPoint()->GetStepStatus() == fGeomBoundary && aStep->GetPostStepPoint()->GetPhysicalVolume()->GetName().find("psSiPM") != std::string::npos)
-			runAction->AddDetectedPhoton(aStep);
-	}
-	else if(track->GetTrackStatus() != fAlive) return;
-	else if(neutronTrack){ // Normal scattering event.
-		if(track->GetTrackID() != 1)
-			neutronTrack = false;
-		else if(aStep->GetPostStepPoint()->GetPhysicalVolume()->GetName() == "expHall_physV"){ // Exiting the detector.
-			runAction->finalizeNeutron(aStep);
-			neutronTrack = false;
-			return;
+	const G4StepPoint *postStep = step->GetPostStepPoint();
+	if(track->GetDefinition() != G4OpticalPhoton::OpticalPhotonDefinition()){
+		// Kill particles in the world volume which may no longer reach any detector
+		if(construction->GetKillMode() != nDetConstruction::KILL_OFF && construction->GetVolumeRole(postStep->GetPhysicalVolume()) == nDetConstruction::WORLD &&
+		   construction->CheckKillParticle(postStep->GetPosition(), postStep->GetMomentumDirection())){
+			track->SetTrackStatus(fStopAndKill);
 		}
-		else
-			runAction->scatterNeutron(aStep);
+		return;
+	}
+
+	if(track->GetCurrentStepNumber() == 1) // New optical photon track
+		numReflections = 0;
+
+	if(postStep->GetStepStatus() == fGeomBoundary && !construction->GetTrackPhotonsOutsideDetectors() && construction->GetVolumeRole(postStep->GetPhysicalVolume()) == nDetConstruction::WORLD){
+		track->SetTrackStatus(fStopAndKill); // Leaving the detectors
+		runAction->countPhotonCut(nDetRunAction::OUTSIDE_CUT);
+	}
+	else if(construction->GetPhotonMaxTime() > 0 && postStep->GetGlobalTime() > construction->GetPhotonMaxTime()){
+		track->SetTrackStatus(fStopAndKill);
+		runAction->countPhotonCut(nDetRunAction::TIME_CUT);
 	}
-	else if(track->GetTrackID() == 1){ // This is a primary particle scatter event.
-		runAction->initializeNeutron(aStep);
-		neutronTrack = true;
+	else if(construction->GetPhotonMaxTrackLength() > 0 && track->GetTrackLength() > construction->GetPhotonMaxTrackLength()){
+		track->SetTrackStatus(fStopAndKill);
+		runAction->countPhotonCut(nDetRunAction::LENGTH_CUT);
+	}
+	else if(construction->GetPhotonMaxReflections() > 0 && postStep->GetStepStatus() == fGeomBoundary && isReflection(step)){
+		if(++numReflections > construction->GetPhotonMaxReflections()){
+			track->SetTrackStatus(fStopAndKill);
+			runAction->countPhotonCut(nDetRunAction::REFLECTION_CUT);
+		}
 	}
 }
 
-void nDetSteppingAction::Reset(){
-	neutronTrack = false;
+bool nDetSteppingAction::isReflection(const G4Step *step){
+	if(!boundary){ // Find the boundary process of this thread
+		G4ProcessVector *processes = step->GetTrack()->GetDefinition()->GetProcessManager()->GetProcessList();
+		for(size_t i = 0; i < (size_t)processes->size(); i++){
+			if((boundary = dynamic_cast<G4OpBoundaryProcess*>((*processes)[i])))
+				break;
+		}
+		if(!boundary)
+			return false;
+	}
+	
+	switch(boundary->GetStatus()){
+		case FresnelReflection:
+		case TotalInternalReflection:
+		case LambertianReflection:
+		case LobeReflection:
+		case SpikeReflection:
+		case BackScattering:
+			return true;
+		default:
+			break;
+	}
+	return false;
 }
@@ -1,4 +1,12 @@
+#include "G4Track.hh"
+
 #include "nDetTrackingAction.hh"
+#include "nDetRunAction.hh"
 
 nDetTrackingAction::nDetTrackingAction(nDetRunAction *run) : runAction(run) {
 }
+
+void nDetTrackingAction::PreUserTrackingAction(const G4Track *track){
+	if(track->GetTrackID() == 1) // Primary particle
+		runAction->setInitialEnergy(track->GetKineticEnergy());
+}
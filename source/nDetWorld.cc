@@ -17,7 +17,7 @@
 
 #define DEFAULT_FLOOR_MATERIAL "G4_CONCRETE"
 
-nDetWorld::nDetWorld() : solidV(NULL), logV(NULL), physV(NULL), fillMaterial("air"), floorMaterial(), floorThickness(0), floorSurfaceY(0) {
+nDetWorld::nDetWorld() : solidV(NULL), logV(NULL), physV(NULL), fillMaterial("air"), floorMaterial(), floorThickness(0), floorSurfaceY(0), killRegionSize(), killModeAuto(false) {
 	// Set the default size of the experimental hall
 	hallSize = G4ThreeVector(10*m, 10*m, 10*m);
 	
@@ -43,6 +43,19 @@ bool nDetWorld::setWorldFloor(const G4String &input){
 	return true;
 }
 
+void nDetWorld::setKillMode(const G4String &mode){
+	if(mode == "off")
+		killModeAuto = false;
+	else if(mode == "auto")
+		killModeAuto = true;
+	else
+		Display::ErrorPrint("Unrecognized particle kill mode. Expected \"off\" or \"auto\".", "nDetWorld");
+}
+
+bool nDetWorld::hasScatteringMaterial() const {
+	return ((!floorMaterial.empty() && floorThickness > 0) || !objects.empty() || (fillMaterial != "air" && fillMaterial != "vacuum"));
+}
+
 void nDetWorld::buildExpHall(nDetMaterials *materials){
 	solidV = new G4Box("solidV", hallSize.getX()/2, hallSize.getY()/2, hallSize.getZ()/2);
 
@@ -33,6 +33,16 @@ void nDetWorldMessenger::addAllCommands(){
 	
 	addCommand(new G4UIcmdWithAString("/nDet/world/loadGDML", this));
 	addGuidance("Load a GDML geometry from a file and place it in the setup area. SYNTAX: loadGDML <filename> <posX> <posY> <posZ> <rotX> <rotY> <rotZ> <matString>");
+
+	addCommand(new G4UIcmdWithAString("/nDet/world/setKillMode", this));
+	addGuidance("Kill non-optical particles which leave the detectors (default=off). SYNTAX: setKillMode <off|auto>");
+	addGuidance("If the world contains no floor, objects, or dense fill, particles in the world which are not heading towards a detector are killed");
+	addGuidance("Otherwise, particles leaving the kill region (see setKillRegion) are killed");
+	addCandidates("off auto");
+
+	addCommand(new G4UIcmdWith3VectorAndUnit("/nDet/world/setKillRegion", this));
+	addGuidance("Set the size of the box centered on the world origin outside of which particles are killed along the X, Y, and Z axes");
+	addGuidance("Only used by the auto kill mode when the world contains scattering material");
 }
 
 void nDetWorldMessenger::SetNewChildValue(G4UIcommand* command, G4String newValue){
@@ -63,4 +73,10 @@ void nDetWorldMessenger::SetNewChildValue(G4UIcommand* command, G4String newValu
 	else if(index == 7){
 		fWorld->loadGDML(newValue);
 	}
+	else if(index == 8){
+		fWorld->setKillMode(newValue);
+	}
+	else if(index == 9){
+		fWorld->setKillRegion(command->ConvertToDimensioned3Vector(newValue));
+	}
 }
@@ -17,23 +17,21 @@
 
 // using the modular physics list
 #include "G4VModularPhysicsList.hh"
-#include "QGSP_BERT_HP.hh"
 
 #include "nDetActionInitialization.hh"
 #include "nDetMasterOutputFile.hh"
+#include "nDetEventSeeder.hh"
+#include "nDetPhysicsList.hh"
 
 #include "nDetConstruction.hh"
 #include "nDetRunAction.hh"
 #include "nDetEventAction.hh"
 #include "nDetStackingAction.hh"
-#include "nDetSteppingAction.hh"
 #include "nDetTrackingAction.hh"
 #include "optionHandler.hh"
 #include "termColors.hh"
 #include "version.hh"
 
-#include "G4OpticalPhysics.hh"
-
 #include "Randomize.hh"
 #include "time.h"
 
@@ -55,6 +53,12 @@ int main(int argc, char** argv){
 	handler.add(optionExt("verbose", no_argument, NULL, 'v', "", "Toggle verbose mode."));
 	handler.add(optionExt("delay", required_argument, NULL, 'D', "<seconds>", "Set the time delay between successive event counter updates (default=10s)."));
 	handler.add(optionExt("version", no_argument, NULL, 'V', "", "Print the version number."));
+	handler.add(optionExt("seed", required_argument, NULL, 'S', "<seed>", "Set the master random seed (default uses the system time)."));
+	handler.add(optionExt("shard-index", required_argument, NULL, 'k', "<index>", "Set the index of this shard of a split simulation (default=0)."));
+	handler.add(optionExt("shard-count", required_argument, NULL, 'K', "<count>", "Set the total number of shards of a split simulation (default=1)."));
+	handler.add(optionExt("first-event", required_argument, NULL, 'E', "<eventID>", "Set the global ID of the first event (default=0)."));
+	handler.add(optionExt("physics-cache", required_argument, NULL, 'C', "<directory>", "Store and retrieve physics tables using a cache directory."));
+	handler.add(optionExt("physics", required_argument, NULL, 'P', "<profile>", "Set the physics profile to use (optical, em, full, fast, or auto) (default=full)."));
 #ifdef USE_MULTITHREAD
 	handler.add(optionExt("mt-thread-limit", required_argument, NULL, 'n', "<threads>", "Set the number of threads to use (uses all threads for n <= 0)."));
 	handler.add(optionExt("mt-max-threads", no_argument, NULL, 'T', "", "Print the maximum number of threads."));
@@ -97,17 +101,41 @@ int main(int argc, char** argv){
 		return 0;
 	}
 
+	G4long seed = time(NULL); // Use the system time by default
+	if(handler.getOption(8)->active) // Set the master random seed
+		seed = strtol(handler.getOption(8)->argument.c_str(), NULL, 0);
+
+	long shardIndex = 0;
+	if(handler.getOption(9)->active) // Set the shard index
+		shardIndex = strtol(handler.getOption(9)->argument.c_str(), NULL, 0);
+
+	long shardCount = 1;
+	if(handler.getOption(10)->active) // Set the number of shards
+		shardCount = strtol(handler.getOption(10)->argument.c_str(), NULL, 0);
+
+	long firstEvent = 0;
+	if(handler.getOption(11)->active) // Set the first global event ID
+		firstEvent = strtol(handler.getOption(11)->argument.c_str(), NULL, 0);
+
+	std::string physicsCacheDir;
+	if(handler.getOption(12)->active) // Set the physics table cache directory
+		physicsCacheDir = handler.getOption(12)->argument;
+
+	std::string physicsProfileName = "full";
+	if(handler.getOption(13)->active) // Set the physics profile
+		physicsProfileName = handler.getOption(13)->argument;
+
 #ifdef USE_MULTITHREAD
 	G4int numberOfThreads = 1; // Sequential mode by default.
-	if(handler.getOption(8)->active){ 
-		G4int userInput = strtol(handler.getOption(8)->argument.c_str(), NULL, 10);
+	if(handler.getOption(14)->active){ 
+		G4int userInput = strtol(handler.getOption(14)->argument.c_str(), NULL, 10);
 		if(userInput > 0) // Set the number of threads to use.
 			numberOfThreads = std::min(userInput, G4Threading::G4GetNumberOfCores());
 		else // Use all available threads.
 			numberOfThreads = G4Threading::G4GetNumberOfCores();
 	}
 	
-	if(handler.getOption(9)->active){ // Print maximum number of threads.
+	if(handler.getOption(15)->active){ // Print maximum number of threads.
 		std::cout << PROGRAM_NAME << ": Max number of threads on this machine is " << G4Threading::G4GetNumberOfCores() << ".\n";
 		return 0;
 	}
@@ -118,17 +146,40 @@ int main(int argc, char** argv){
 		return 1;
 	}
 
-	//make random number seeds different in different runs in Geant4 simulation
+	// Select the physics profile
+	nDetPhysicsList::physicsProfile physicsProfile;
+	if(physicsProfileName == "auto"){ // Select the profile using the source type defined in the input macro
+		physicsProfile = nDetPhysicsList::getProfileFromMacro(inputFilename);
+	}
+	else if(!nDetPhysicsList::getProfile(physicsProfileName, physicsProfile)){
+		Display::ErrorPrint("Unrecognized physics profile. Expected \"optical\", \"em\", \"full\", \"fast\", or \"auto\".", PROGRAM_NAME);
+		return 1;
+	}
+	std::cout << PROGRAM_NAME << ": Using \"" << nDetPhysicsList::getProfileName(physicsProfile) << "\" physics profile (" << nDetPhysicsList::getPhysicsListName(physicsProfile) << ")\n";
+
+	// Set up reproducible per-event seeding
+	nDetEventSeeder *seeder = &nDetEventSeeder::getInstance();
+	if(!seeder->setShard(shardIndex, shardCount)){
+		Display::ErrorPrint("Invalid shard index or shard count!", PROGRAM_NAME);
+		return 1;
+	}
+	if(!seeder->setFirstEvent(firstEvent)){
+		Display::ErrorPrint("First event ID must not be negative!", PROGRAM_NAME);
+		return 1;
+	}
+	seeder->setMasterSeed(seed);
+
 	//////////////////////////////////////
 	
 	//choose the Random engine
 	CLHEP::HepRandom::setTheEngine(new CLHEP::RanecuEngine());
 	
-	//set random seed with system time
-	G4long seed = time(NULL);
+	//set the random seed of the master thread. Each event is re-seeded from the master seed and its global event ID
 	CLHEP::HepRandom::setTheSeed(seed);
 	
 	std::cout << PROGRAM_NAME << ": Using random seed " << seed << std::endl;
+	if(shardCount > 1 || firstEvent > 0)
+		std::cout << PROGRAM_NAME << ": Running shard " << shardIndex << " of " << shardCount << " starting from global event " << firstEvent << std::endl;
 	
 	//////////////////////////////////////
 
@@ -158,13 +209,16 @@ int main(int argc, char** argv){
 	}
 	runManager->SetUserInitialization(detector);
 
-	G4VModularPhysicsList* physics = new QGSP_BERT_HP();
-
-	G4OpticalPhysics *theOpticalPhysics=new G4OpticalPhysics();
-	theOpticalPhysics->SetScintillationByParticleType(true);
-	physics->ReplacePhysics(theOpticalPhysics);
+	G4VModularPhysicsList* physics = nDetPhysicsList::build(physicsProfile);
 	runManager->SetUserInitialization(physics);
 
+	// Physics tables are retrieved from the cache when the geometry is constructed
+	detector->SetPhysicsList(physics, nDetPhysicsList::getPhysicsListName(physicsProfile));
+	if(!physicsCacheDir.empty()){
+		std::cout << PROGRAM_NAME << ": Using physics table cache directory \"" << physicsCacheDir << "\"\n";
+		detector->SetPhysicsCacheDirectory(physicsCacheDir);
+	}
+
 #ifdef G4VIS_USE
 	// add visulization manager
 	G4VisManager *visManager = new G4VisExecutive;
@@ -222,6 +276,10 @@ int main(int argc, char** argv){
 	stream << seed;
 	output->writeInfoToFile("seed", stream.str());
 
+	// Write the seeding scheme and the global event ID offset of each run to the file.
+	output->writeInfoToFile("seedScheme", seeder->getSchemeString());
+	output->writeInfoToFile("eventOffsets", seeder->getOffsetString());
+
 	// Write the program version number to the file.
 	output->writeInfoToFile("version", VERSION_STRING);
 
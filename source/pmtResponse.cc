@@ -1,5 +1,8 @@
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
 #include <cmath>
 
 #include "TFile.h"
@@ -11,6 +14,10 @@
 
 const double sqrt2pi = 2.5066282746;
 
+const size_t kernelPoints = 4096; ///< Number of points in the tabulated single-photon-response function
+
+const size_t spectrumPoints = 4096; ///< Number of points in the uniformly resampled quantum efficiency spectrum
+
 void copyTGraph(TGraph *g, std::vector<double> &xvec, std::vector<double> &yvec){
 	double x, y;
 	xvec.clear();
@@ -38,6 +45,8 @@ spectralResponse spectralResponse::clone() const {
 	retval.size = size;
 	retval.wavelength = wavelength;
 	retval.percentage = percentage;
+	retval.table = table;
+	retval.tableStep = tableStep;
 	return retval;
 }
 
@@ -53,6 +62,7 @@ void spectralResponse::copy(const spectralResponse *other){
 	xmin = wavelength.front();
 	xmax = wavelength.back();
 	size = wavelength.size();
+	buildTable();
 }
 
 /// Load response function from a file.
@@ -69,55 +79,79 @@ bool spectralResponse::load(const std::string &fname){
 		}
 		copyTGraph(g1, wavelength, percentage);
 	
-		xmin = wavelength.front();
-		xmax = wavelength.back();
-		size = wavelength.size();
-	
 		f->Close();
 		delete f;	
 	}
 	else{ // Ascii file
 		std::ifstream f(fname.c_str());
 		if(!f.good()) return false;
+		std::string line;
 		double xval, yval;
-		while(true){
-			f >> xval >> yval;
-			if(f.eof())
-				break;
+		while(std::getline(f, line)){
+			std::stringstream stream(line);
+			if(!(stream >> xval >> yval)) // Skip column headers and blank lines
+				continue;
 			wavelength.push_back(xval);
 			percentage.push_back(yval);
 		}
 		
-		xmin = wavelength.front();
-		xmax = wavelength.back();
-		size = wavelength.size();
-		
 		f.close();
 	}
 	
+	if(wavelength.empty())
+		return false;
+
+	xmin = wavelength.front();
+	xmax = wavelength.back();
+	size = wavelength.size();
+	buildTable();
+	
 	return true;
 }
 
+double spectralResponse::getMaximum() const {
+	return (!percentage.empty() ? *std::max_element(percentage.begin(), percentage.end()) : 0);
+}
+
 /// Return the PMT quantum efficiency for a given wavelength.
 double spectralResponse::eval(const double &lambda_) const {
-	if(size == 0) return 0;
-	if(lambda_ >= xmin && lambda_ <= xmax){ // Interpolate the distribution.
-		for(size_t i = 0; i < size-1; i++){
-			if(lambda_ == wavelength.at(i))
-				return percentage.at(i);
-			else if(lambda_ > wavelength.at(i) && lambda_ <= wavelength.at(i+1))
-				return (percentage.at(i)+(percentage.at(i+1)-percentage.at(i))*(lambda_-wavelength.at(i))/(wavelength.at(i+1)-wavelength.at(i)));
-		}
+	if(table.empty() || lambda_ < xmin || lambda_ > xmax) return 0;
+	double x = (lambda_-xmin)/tableStep;
+	size_t index = (size_t)x;
+	if(index >= table.size()-1) return table.back();
+	return (table[index] + (table[index+1]-table[index])*(x-index));
+}
+
+void spectralResponse::buildTable(){
+	table.clear();
+	tableStep = 0;
+	if(size < 2 || xmax <= xmin) return;
+
+	// Linearly interpolate the input spectrum at each point of the grid. Both are in ascending 
+	// order, so the input is only traversed once
+	tableStep = (xmax-xmin)/(spectrumPoints-1);
+	table.resize(spectrumPoints);
+	size_t i = 0;
+	for(size_t index = 0; index < spectrumPoints; index++){
+		double lambda = (index < spectrumPoints-1 ? xmin + index*tableStep : xmax);
+		while(i < size-2 && lambda > wavelength[i+1])
+			i++;
+		double width = wavelength[i+1]-wavelength[i];
+		if(width > 0)
+			table[index] = percentage[i]+(percentage[i+1]-percentage[i])*(lambda-wavelength[i])/width;
+		else
+			table[index] = percentage[i];
 	}
-	return 0;
 }
 
 void spectralResponse::clear(){
 	wavelength.clear();
 	percentage.clear();
+	table.clear();
 	xmin = 0;
 	xmax = 0;
 	size = 0;
+	tableStep = 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -126,16 +160,20 @@ void spectralResponse::clear(){
 
 pmtResponse::pmtResponse() : risetime(4.0), falltime(20.0), timeSpread(0), traceDelay(50), gain(1E4), maximum(-9999), baseline(-9999),
                              baselineFraction(0), baselineJitterFraction(0), polyCfdFraction(0.5), adcClockTick(4), tLatch(0), pulseIntegralLow(5), pulseIntegralHigh(10),
-                             maxIndex(0), adcBins(4096), pulseLength(100), isDigitized(false), useSpectralResponse(false), pulseIsSaturated(false),
-                             printTrace(false), pulseArray(), spec(), minimumArrivalTime(0), functionType(EXPO) {
+                             maxIndex(0), adcBins(4096), pulseLength(100), isDigitized(false), useSpectralResponse(false), qeAppliedAtBirth(false), pulseIsSaturated(false),
+                             printTrace(false), pulseArray(), spec(), minimumArrivalTime(0), weightedArrivalTime(0), anodeIndex(-1), anodeFractions(), functionType(EXPO), kernel(), kernelStart(0), kernelStep(0),
+                             customKernel(), customKernelStart(0), customKernelStep(0) {
 	this->setPulseLength(pulseLength);
+	this->updateKernel();
 }
 
 pmtResponse::pmtResponse(const double &risetime_, const double &falltime_) : risetime(risetime_), falltime(falltime_), timeSpread(0), traceDelay(50), gain(1E4), maximum(-9999), baseline(-9999),
                                                                              baselineFraction(0), baselineJitterFraction(0), polyCfdFraction(0.5), adcClockTick(4), tLatch(0), pulseIntegralLow(5), pulseIntegralHigh(10),
-                                                                             maxIndex(0), adcBins(4096), pulseLength(100), isDigitized(false), useSpectralResponse(false), pulseIsSaturated(false),
-                                                                             printTrace(false), pulseArray(), spec(), minimumArrivalTime(0), functionType(EXPO) {
+                                                                             maxIndex(0), adcBins(4096), pulseLength(100), isDigitized(false), useSpectralResponse(false), qeAppliedAtBirth(false), pulseIsSaturated(false),
+                                                                             printTrace(false), pulseArray(), spec(), minimumArrivalTime(0), weightedArrivalTime(0), anodeIndex(-1), anodeFractions(), functionType(EXPO), kernel(), kernelStart(0), kernelStep(0),
+                             customKernel(), customKernelStart(0), customKernelStep(0) {
 	this->setPulseLength(pulseLength);
+	this->updateKernel();
 }
 
 pmtResponse::~pmtResponse(){
@@ -157,37 +195,70 @@ pmtResponse pmtResponse::clone() const {
 	retval.adcBins = adcBins;
 	retval.pulseLength = pulseLength;
 	retval.useSpectralResponse = useSpectralResponse;
+	retval.qeAppliedAtBirth = qeAppliedAtBirth;
 	retval.printTrace = printTrace;
-	retval.pulseArray = pulseArray;
-	retval.spec = spec.clone();
+	retval.spec = spec;
+	retval.anodeIndex = anodeIndex;
+	retval.anodeFractions = anodeFractions;
 	retval.functionType = functionType;
+	retval.kernel = kernel;
+	retval.kernelStart = kernelStart;
+	retval.kernelStep = kernelStep;
+	retval.customKernel = customKernel;
+	retval.customKernelStart = customKernelStart;
+	retval.customKernelStep = customKernelStep;
 	return retval;
 }
 
-/// Return the gain-weighted arrival time of the photon pulse.
-double pmtResponse::getWeightedPhotonArrivalTime() const {
-	double weightedAverage = 0;
-	double totalWeight = 0;
-	std::vector<double>::const_iterator iter1, iter2;
-	for(auto arrival : arrivalTimes){
-		weightedAverage += arrival.time * arrival.gain;
-		totalWeight += arrival.gain;
+double pmtResponse::getHitWeight(const photonHitBuffer &hits, const size_t &index) const {
+	if(anodeIndex < 0){ // Dynode readout
+		if(useSpectralResponse && spec && !qeAppliedAtBirth) // Compute the quantum efficiency of the PMT for this wavelength.
+			return hits.gain[index]*spec->eval(hits.wavelength[index])/100;
+		return hits.gain[index];
 	}
-	return weightedAverage/totalWeight;
+	
+	// Anger logic anode readout
+	size_t cell = 4*hits.pixel[index] + anodeIndex;
+	if(hits.pixel[index] < 0 || !anodeFractions || cell >= anodeFractions->size())
+		return 0;
+	return hits.gain[index]*(*anodeFractions)[cell];
+}
+
+double pmtResponse::sampleTransitTimeOffset() const {
+	if(timeSpread > 0) // Smear the time offset based on the photo-electron transit time spread.
+		return (G4UniformRand()-0.5)*timeSpread;
+	return 0;
+}
+
+bool pmtResponse::sharesResponseWith(const pmtResponse &other) const {
+	return (functionType == other.functionType && risetime == other.risetime && falltime == other.falltime && traceDelay == other.traceDelay && 
+	        adcClockTick == other.adcClockTick && tLatch == other.tLatch && pulseLength == other.pulseLength && kernel == other.kernel);
+}
+
+void pmtResponse::setAnodeChannel(const short &index, const std::shared_ptr<const std::vector<double> > &fractions){
+	anodeIndex = index;
+	anodeFractions = fractions;
 }
 
 void pmtResponse::setRisetime(const double &risetime_){ 
 	risetime = risetime_; 
+	this->updateKernel();
 }
 
 void pmtResponse::setFalltime(const double &falltime_){ 
 	falltime = falltime_; 
+	this->updateKernel();
+}
+
+void pmtResponse::setFunctionType(const photonResponseType &type){
+	functionType = type;
+	this->updateKernel();
 }
 
 /// Set the length of the pulse in ADC bins.
 void pmtResponse::setPulseLength(const size_t &len){
 	pulseLength = len;
-	pulseArray = std::vector<unsigned short>(pulseLength, 0);
+	pulseArray.clear(); // Re-allocated by the next call to digitize()
 	this->clear();
 }
 
@@ -204,61 +275,132 @@ void pmtResponse::setBitRange(const size_t &len){
 
 /// Load PMT spectral response from root file.
 bool pmtResponse::loadSpectralResponse(const char *fname){
-	return (useSpectralResponse = spec.load(fname));
-}
-
-void pmtResponse::addPhoton(const double &arrival, const double &wavelength/*=0*/, const double &gain_/*=1*/){
-	double efficiency = 1;
-	if(useSpectralResponse){ // Compute the quantum efficiency of the PMT for this wavelength.
-		efficiency = spec.eval(wavelength)/100;
+	spectralResponse *newSpec = new spectralResponse();
+	if(!newSpec->load(fname)){
+		delete newSpec;
+		spec.reset();
+		return (useSpectralResponse = false);
 	}
-
-	// Compute the offset of the response function due to the trace delay and the time spread of the PMT
-	double dt = arrival + traceDelay; // Arrival time is the leading edge of the pulse.
-	if(timeSpread > 0){ // Smear the time offset based on the photo-electron transit time spread.
-		dt += (G4UniformRand()-0.5)*timeSpread;
+	spec.reset(newSpec);
+	return (useSpectralResponse = true);
+}
+
+/// Load a measured single photon response from a file.
+bool pmtResponse::loadSinglePhotonResponse(const char *fname){
+	spectralResponse response;
+	if(!response.load(fname) || response.getSize() < 2)
+		return false;
+
+	// Resample the response onto a uniform grid.
+	double tmin, tmax;
+	response.getRange(tmin, tmax);
+	if(tmax <= tmin)
+		return false;
+	double step = (tmax-tmin)/(kernelPoints-1);
+	std::vector<double> *table = new std::vector<double>(kernelPoints);
+	double integral = 0;
+	for(size_t i = 0; i < kernelPoints; i++){
+		(*table)[i] = response.eval(tmin + i*step);
+		if(i > 0) // Trapezoidal rule
+			integral += 0.5*((*table)[i-1]+(*table)[i])*step;
+	}
+	if(integral <= 0){
+		delete table;
+		return false;
 	}
 
-	// Add the photon to the list of arrival times
-	arrivalTimes.push_back(photonArrivalTime(arrival, gain_*efficiency, (dt >= 0 ? dt : 0)));
+	// Normalize the response to unit integral.
+	for(size_t i = 0; i < kernelPoints; i++)
+		(*table)[i] /= integral;
+
+	customKernel.reset(table);
+	customKernelStart = tmin;
+	customKernelStep = step;
 
-	// Check if this is the first photon
-	if(arrival < minimumArrivalTime)
-		minimumArrivalTime = arrival;
+	this->setFunctionType(CUSTOM);
+	
+	return true;
 }
 
-double pmtResponse::sample(const double &time) const {
+double pmtResponse::sample(const photonHitBuffer &hits, const double &time) const {
 	double retval = 0;
-	for(auto arrival : arrivalTimes)
-		retval += arrival.gain * func(time, arrival.dt);
+	for(size_t i = 0; i < hits.size(); i++)
+		retval += getHitWeight(hits, i) * func(time, getResponseOffset(hits, i));
 	return retval;
 }
 
-void pmtResponse::getRawPulse(std::vector<double> &rawPulse) const {
-	rawPulse = std::vector<double>(pulseLength, 0);
-	double time = tLatch + adcClockTick/2;
+void pmtResponse::getRawPulse(const photonHitBuffer &hits, std::vector<double> &rawPulse) const {
+	synthesize(hits, rawPulse); // Sample the total light response spectrum
 	double prevAmp = 0;
 	for(size_t index = 0; index < pulseLength; index++){
-		rawPulse[index] = sample(time); // Sample the total light response spectrum
 		if(rawPulse[index] < prevAmp && rawPulse[index] < 1){ // Amplitude is less than one ADC bin
-			rawPulse[index] = 0;
+			std::fill(rawPulse.begin()+index, rawPulse.end(), 0);
 			break;
 		}
 		prevAmp = rawPulse[index];
-		time += adcClockTick;
 	}
 }
 
-void pmtResponse::digitize(const double &baseline_, const double &jitter_){
+void pmtResponse::digitize(const photonHitBuffer &hits, const double &baseline_, const double &jitter_){
 	if(isDigitized) 
 		return;
-	pulseIsSaturated = false;
 	
+	// Sample the total light response spectrum
+	synthesize(hits, rawPulseArray);
+	digitizeRawPulse(hits, baseline_, jitter_);
+}
+
+void pmtResponse::digitize(const photonHitBuffer &hits){
+	this->digitize(hits, baselineFraction, baselineJitterFraction);
+}
+
+void pmtResponse::digitize(const photonHitBuffer &hits, pmtResponse **channels, const size_t &nChannels){
+	// Collect all channels which may be built in the same pass as the first one
+	std::vector<const pmtResponse*> shared;
+	std::vector<std::vector<double>*> pulses;
+	for(size_t i = 0; i < nChannels; i++){
+		if(channels[i]->isDigitized)
+			continue;
+		if(shared.empty() || shared.front()->sharesResponseWith(*channels[i])){
+			shared.push_back(channels[i]);
+			pulses.push_back(&channels[i]->rawPulseArray);
+		}
+		else // Different response function, build it separately
+			channels[i]->synthesize(hits, channels[i]->rawPulseArray);
+	}
+	if(!shared.empty())
+		synthesize(hits, shared.data(), pulses.data(), shared.size());
+
+	// Digitize all channels
+	for(size_t i = 0; i < nChannels; i++){
+		if(!channels[i]->isDigitized)
+			channels[i]->digitizeRawPulse(hits, channels[i]->baselineFraction, channels[i]->baselineJitterFraction);
+	}
+}
+
+void pmtResponse::digitizeRawPulse(const photonHitBuffer &hits, const double &baseline_, const double &jitter_){
+	pulseIsSaturated = false;
+
+	// Compute the minimum and the gain-weighted photon arrival times
+	double totalWeight = 0;
+	weightedArrivalTime = 0;
+	minimumArrivalTime = 1E6;
+	for(size_t i = 0; i < hits.size(); i++){
+		double weight = getHitWeight(hits, i);
+		weightedArrivalTime += hits.time[i]*weight;
+		totalWeight += weight;
+		if(hits.time[i] < minimumArrivalTime)
+			minimumArrivalTime = hits.time[i];
+	}
+	weightedArrivalTime = (totalWeight > 0 ? weightedArrivalTime/totalWeight : 0);
+
+	if(pulseArray.size() != pulseLength)
+		pulseArray.resize(pulseLength);
+
 	// Digitize the light pulse
 	unsigned int value, bin;
-	double time = tLatch + adcClockTick/2;
 	for(size_t i = 0; i < pulseLength; i++){
-		bin = (unsigned int)floor(sample(time)); // Sample the total light response spectrum
+		bin = (unsigned int)floor(rawPulseArray[i]);
 		if(bin >= adcBins) bin = adcBins-1;
 		value = bin;
 		value += baseline_*adcBins;
@@ -270,14 +412,10 @@ void pmtResponse::digitize(const double &baseline_, const double &jitter_){
 			pulseIsSaturated = true;
 			pulseArray[i] = (unsigned short)(adcBins-1);
 		}
-		time += adcClockTick;
 	}
 	isDigitized = true;
 }
 
-void pmtResponse::digitize(){
-	this->digitize(baselineFraction, baselineJitterFraction);
-}
 
 /// Integrate the baseline corrected trace for QDC in the range [start_, stop_] and return the result.
 double pmtResponse::integratePulse(const size_t &start_, const size_t &stop_){
@@ -381,16 +519,21 @@ double pmtResponse::analyzePolyCFD(){
 }
 
 void pmtResponse::copyTrace(unsigned short *arr, const size_t &len){
-	if(!isDigitized) this->digitize();
-	size_t stop = (len <= pulseLength ? len : pulseLength);
+	size_t stop = (len <= pulseArray.size() ? len : pulseArray.size());
 	for(size_t i = 0; i < stop; i++){
 		arr[i] = pulseArray[i];
 	}
+	for(size_t i = stop; i < len; i++) // The pulse has not been digitized
+		arr[i] = 0;
 }
 
 /// Copy the digitized trace into a vector.
 void pmtResponse::copyTrace(std::vector<unsigned short> &vec){
 	vec.clear();
+	if(pulseArray.size() != pulseLength){ // The pulse has never been digitized
+		vec.assign(pulseLength, 0);
+		return;
+	}
 	vec.reserve(pulseLength);
 	for(size_t i = 0; i < pulseLength; i++){
 		vec.push_back(pulseArray[i]);
@@ -407,15 +550,13 @@ void pmtResponse::clear(){
 	baseline = -9999;
 
 	minimumArrivalTime = 1E6;
-
-	arrivalTimes.clear();
+	weightedArrivalTime = 0;
 
 	maxIndex = 0;
 	
 	isDigitized = false;
 	
-	for(size_t i = 0; i < pulseLength; i++)
-		pulseArray[i] = 0;
+	std::fill(pulseArray.begin(), pulseArray.end(), 0);
 }
 
 void pmtResponse::print(){
@@ -434,6 +575,11 @@ void pmtResponse::print(){
 		std::cout << "* response : gaussian\n";
 		std::cout << "* sigma    : " << risetime << " ns" << std::endl;
 	}
+	else if(functionType == CUSTOM){
+		std::cout << "* response : custom\n";
+		if(kernel)
+			std::cout << "* range    : " << kernelStart << " to " << kernelStart+(kernel->size()-1)*kernelStep << " ns" << std::endl;
+	}
 	std::cout << "* spread   : " << timeSpread << " ns" << std::endl;
 	std::cout << "* delay    : " << traceDelay << " ns" << std::endl;
 	std::cout << "* gain     : " << gain << "x" << std::endl;
@@ -515,9 +661,54 @@ double pmtResponse::func(const double &t, const double &dt/*=0*/) const {
 	else if(functionType == GAUSS){ // Normalized gaussian function. The risetime is sigma and the decay time is not used.
 		return gain*((1/(risetime*sqrt2pi))*std::exp(-0.5*std::pow((t-dt)/risetime, 2.0)));
 	}
+	else if(functionType == CUSTOM){ // Measured single photon response function.
+		return gain*evalKernel(t-dt);
+	}
 	return 0;
 }
 
+double pmtResponse::evalKernel(const double &tau) const {
+	if(!kernel || kernel->empty()) return 0;
+	double x = (tau-kernelStart)/kernelStep;
+	if(x < 0) return 0;
+	const std::vector<double> &table = *kernel;
+	size_t index = (size_t)x;
+	if(index >= table.size()-1) return 0;
+	return (table[index] + (table[index+1]-table[index])*(x-index));
+}
+
+void pmtResponse::updateKernel(){
+	kernel.reset();
+	kernelStart = 0;
+	kernelStep = 0;
+	if(functionType == VANDLE){ // Tabulate the leading edge. The tail is handled recursively.
+		if(falltime == 0) return;
+		kernelStep = (std::pow(40.0, 0.25)/std::fabs(falltime))/(kernelPoints-1);
+	}
+	else if(functionType == GAUSS){ // Tabulate +/- 10 sigma.
+		if(risetime == 0) return;
+		kernelStart = -10*std::fabs(risetime);
+		kernelStep = 20*std::fabs(risetime)/(kernelPoints-1);
+	}
+	else if(functionType == CUSTOM){
+		kernel = customKernel;
+		kernelStart = customKernelStart;
+		kernelStep = customKernelStep;
+		return;
+	}
+	else // The EXPO response is computed recursively.
+		return;
+	std::vector<double> *table = new std::vector<double>(kernelPoints);
+	for(size_t i = 0; i < kernelPoints; i++){
+		double tau = kernelStart + i*kernelStep;
+		if(functionType == VANDLE)
+			(*table)[i] = (tau > 0 ? 100*std::exp(-tau*risetime)*(1 - std::exp(-std::pow(tau*falltime, 4))) : 0);
+		else
+			(*table)[i] = (1/(risetime*sqrt2pi))*std::exp(-0.5*std::pow(tau/risetime, 2.0));
+	}
+	kernel.reset(table);
+}
+
 double pmtResponse::findMaximum(){
 	if(pulseLength == 0 || pulseArray.empty()) return -9999;
 
@@ -548,3 +739,143 @@ double pmtResponse::findMaximum(){
 
 	return maximum;
 }
+
+bool pmtResponse::getFirstSample(const double &dt, size_t &index) const {
+	double t0 = tLatch + adcClockTick/2; // Time of the first ADC sample
+	if(dt < t0){
+		index = 0;
+		return (pulseLength > 0);
+	}
+	index = (size_t)floor((dt-t0)/adcClockTick) + 1;
+	if(index > 0 && t0 + (index-1)*adcClockTick > dt) // Correct for rounding errors
+		index--;
+	else if(t0 + index*adcClockTick <= dt)
+		index++;
+	return (index < pulseLength);
+}
+
+double pmtResponse::getResponseOffset(const photonHitBuffer &hits, const size_t &index) const {
+	double dt = hits.time[index] + traceDelay + hits.dt[index]; // Arrival time is the leading edge of the pulse.
+	return (dt >= 0 ? dt : 0);
+}
+
+void pmtResponse::synthesize(const photonHitBuffer &hits, std::vector<double> &pulse) const {
+	const pmtResponse *channel = this;
+	std::vector<double> *output = &pulse;
+	synthesize(hits, &channel, &output, 1);
+}
+
+void pmtResponse::synthesize(const photonHitBuffer &hits, const pmtResponse * const *channels, std::vector<double> * const *pulses, const size_t &nChannels){
+	// The response function and the sampling of the first channel are used for all channels
+	const pmtResponse *shape = channels[0];
+	const size_t pulseLength = shape->pulseLength;
+	const double adcClockTick = shape->adcClockTick;
+	const double risetime = shape->risetime;
+	const double falltime = shape->falltime;
+
+	for(size_t c = 0; c < nChannels; c++)
+		pulses[c]->assign(pulseLength, 0);
+	if(hits.empty() || pulseLength == 0)
+		return;
+
+	double t0 = shape->tLatch + adcClockTick/2; // Time of the first ADC sample
+	size_t index;
+
+	// Weight of the current photon in each channel, including the gain of the channel
+	std::vector<double> weights(nChannels);
+	bool anyWeight;
+
+	if(shape->functionType == EXPO){
+		// Add each photon to both exponential terms at the first sample following its arrival.
+		std::vector<std::vector<double> > riseInput(nChannels, std::vector<double>(pulseLength, 0));
+		for(size_t i = 0; i < hits.size(); i++){
+			anyWeight = false;
+			for(size_t c = 0; c < nChannels; c++)
+				anyWeight |= ((weights[c] = channels[c]->getHitWeight(hits, i)) != 0);
+			double dt = shape->getResponseOffset(hits, i);
+			if(!anyWeight || !shape->getFirstSample(dt, index)) continue;
+			double tau = t0 + index*adcClockTick - dt;
+			double fall = std::exp(-tau/falltime);
+			double rise = std::exp(-tau/risetime);
+			for(size_t c = 0; c < nChannels; c++){
+				(*pulses[c])[index] += weights[c]*fall;
+				riseInput[c][index] += weights[c]*rise;
+			}
+		}
+
+		// Propagate both exponentials along the trace.
+		double fallDecay = std::exp(-adcClockTick/falltime);
+		double riseDecay = std::exp(-adcClockTick/risetime);
+		for(size_t c = 0; c < nChannels; c++){
+			std::vector<double> &pulse = *pulses[c];
+			double scale = channels[c]->gain*(1/(falltime-risetime));
+			double fallSum = 0;
+			double riseSum = 0;
+			for(size_t i = 0; i < pulseLength; i++){
+				fallSum = fallSum*fallDecay + pulse[i];
+				riseSum = riseSum*riseDecay + riseInput[c][i];
+				pulse[i] = scale*(fallSum-riseSum);
+			}
+		}
+	}
+	else if(shape->functionType == VANDLE){
+		if(falltime == 0) // The response is identically zero.
+			return;
+		
+		// For (t*gamma)^4 > 40 the leading edge term is equal to one to within double precision.
+		if(!shape->kernel) // The leading edge has not been tabulated.
+			return;
+		double tailStart = shape->kernelStep*(shape->kernel->size()-1);
+		std::vector<std::vector<double> > tailInput(nChannels, std::vector<double>(pulseLength, 0));
+		for(size_t i = 0; i < hits.size(); i++){
+			anyWeight = false;
+			for(size_t c = 0; c < nChannels; c++)
+				anyWeight |= ((weights[c] = channels[c]->getHitWeight(hits, i)) != 0);
+			double dt = shape->getResponseOffset(hits, i);
+			if(!anyWeight || !shape->getFirstSample(dt, index)) continue;
+			for(; index < pulseLength; index++){
+				double tau = t0 + index*adcClockTick - dt;
+				if(tau >= tailStart){ // Purely exponential tail.
+					double tail = std::exp(-tau*risetime);
+					for(size_t c = 0; c < nChannels; c++)
+						tailInput[c][index] += weights[c]*tail;
+					break;
+				}
+				double value = shape->evalKernel(tau);
+				for(size_t c = 0; c < nChannels; c++)
+					(*pulses[c])[index] += weights[c]*channels[c]->gain*value;
+			}
+		}
+
+		// Propagate the exponential tail along the trace.
+		double tailDecay = std::exp(-adcClockTick*risetime);
+		for(size_t c = 0; c < nChannels; c++){
+			std::vector<double> &pulse = *pulses[c];
+			double tailSum = 0;
+			for(size_t i = 0; i < pulseLength; i++){
+				tailSum = tailSum*tailDecay + tailInput[c][i];
+				pulse[i] += 100*channels[c]->gain*tailSum;
+			}
+		}
+	}
+	else if(shape->kernel && !shape->kernel->empty()){ // Tabulated response (GAUSS or CUSTOM)
+		// The gaussian response is negligible (less than 1E-21 of its maximum) beyond 10 sigma.
+		double kernelStart = shape->kernelStart;
+		double kernelStop = kernelStart + shape->kernelStep*(shape->kernel->size()-1);
+		for(size_t i = 0; i < hits.size(); i++){
+			anyWeight = false;
+			for(size_t c = 0; c < nChannels; c++)
+				anyWeight |= ((weights[c] = channels[c]->getHitWeight(hits, i)*channels[c]->gain) != 0);
+			if(!anyWeight) continue;
+			double dt = shape->getResponseOffset(hits, i);
+			double first = (dt + kernelStart - t0)/adcClockTick;
+			for(index = (first > 0 ? (size_t)ceil(first) : 0); index < pulseLength; index++){
+				double tau = t0 + index*adcClockTick - dt;
+				if(tau >= kernelStop) break;
+				double value = shape->evalKernel(tau);
+				for(size_t c = 0; c < nChannels; c++)
+					(*pulses[c])[index] += weights[c]*value;
+			}
+		}
+	}
+}
@@ -0,0 +1,537 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <climits>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "TROOT.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TChain.h"
+#include "TNamed.h"
+#include "TKey.h"
+#include "TDirectory.h"
+
+#include "optionHandler.hh" // split_str
+#include "termColors.hh"
+#include "nDetStructures.hpp" // Local library
+
+#ifndef PROGRAM_NAME
+#define PROGRAM_NAME "nextMerge"
+#endif
+
+// Setup commands which are expected to differ between shards of the same simulation
+const std::string defaultIgnored[] = {"filename", "title", "overwrite", "index", "message", "perThread", "writerQueue"};
+const size_t numDefaultIgnored = 7;
+
+///////////////////////////////////////////////////////////////////////////////
+// class eventSegment
+///////////////////////////////////////////////////////////////////////////////
+
+/** All events of a single run of a single input file, sorted by global event ID
+  */
+class eventSegment{
+  public:
+	size_t file; ///< Index of the input file
+	short runNb; ///< Geant run number
+	long offset; ///< Global ID of event zero of the run
+
+	std::vector<std::pair<long, long long> > entries; ///< Global event ID and TTree entry of every event
+
+	eventSegment() : file(0), runNb(0), offset(0) { }
+
+	eventSegment(const size_t &file_, const short &runNb_) : file(file_), runNb(runNb_), offset(0) { }
+
+	long first() const { return (!entries.empty() ? entries.front().first : offset); }
+
+	long last() const { return (!entries.empty() ? entries.back().first : offset); }
+
+	bool operator < (const eventSegment &rhs) const { return (first() < rhs.first()); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// class shardFile
+///////////////////////////////////////////////////////////////////////////////
+
+/** Setup and provenance information of a single input file
+  */
+class shardFile{
+  public:
+	std::string filename; ///< Path to the input file
+	std::string seed; ///< The random seed record
+	std::string version; ///< The program version record
+	std::string seedScheme; ///< The seeding scheme record
+
+	std::vector<std::pair<std::string, std::string> > setup; ///< Name and full command string of all commands in the setup directory, in the order they were called
+	std::map<short, long> offsets; ///< Global event ID offset of each run
+	std::map<short, std::vector<std::pair<int, long long> > > events; ///< Local event ID and TTree entry of every event for each run
+
+	bool good; ///< Flag indicating that the file was read successfully
+	bool hasOffsets; ///< Flag indicating that the file contains global event ID offsets
+
+	shardFile() : good(false), hasOffsets(false) { }
+
+	shardFile(const std::string &fname) : filename(fname), good(false), hasOffsets(false) { }
+
+	bool scan(const std::string &treename);
+};
+
+/** Read a TNamed record from a directory and return its title, or an empty string if it does not exist
+  */
+std::string readRecord(TDirectory *dir, const std::string &name){
+	TNamed *named = dynamic_cast<TNamed*>(dir->Get(name.c_str()));
+	return (named ? std::string(named->GetTitle()) : "");
+}
+
+/** Get the full command strings of all setup commands of a file which are not ignored, in the order they were called
+  */
+std::vector<std::string> getSetupCommands(const shardFile &file, const std::set<std::string> &ignored){
+	std::vector<std::string> commands;
+	for(std::vector<std::pair<std::string, std::string> >::const_iterator cmd = file.setup.begin(); cmd != file.setup.end(); cmd++){
+		if(ignored.find(cmd->first) == ignored.end())
+			commands.push_back(cmd->second);
+	}
+	return commands;
+}
+
+bool shardFile::scan(const std::string &treename){
+	TFile *f = TFile::Open(filename.c_str(), "READ");
+	if(!f || !f->IsOpen()){
+		Display::ErrorPrint("Failed to open input file \""+filename+"\"!", PROGRAM_NAME);
+		delete f;
+		return false;
+	}
+
+	// Read the setup commands
+	TDirectory *dir = dynamic_cast<TDirectory*>(f->Get("setup"));
+	if(dir){
+		// Repeated commands are stored as several cycles of the same key. Keys are written
+		// sequentially, so sorting by file position restores the order of all calls
+		std::vector<std::pair<Long64_t, TKey*> > keys;
+		TIter next(dir->GetListOfKeys());
+		TKey *key;
+		while((key = (TKey*)next()))
+			keys.push_back(std::make_pair(key->GetSeekKey(), key));
+		std::sort(keys.begin(), keys.end());
+		for(std::vector<std::pair<Long64_t, TKey*> >::iterator iter = keys.begin(); iter != keys.end(); iter++){
+			TNamed *named = dynamic_cast<TNamed*>(iter->second->ReadObj());
+			if(!named) continue;
+			setup.push_back(std::make_pair(std::string(named->GetName()), std::string(named->GetTitle())));
+			delete named;
+		}
+	}
+	else
+		Display::WarningPrint("Input file \""+filename+"\" has no setup directory.", PROGRAM_NAME);
+
+	// Read the provenance records
+	seed = readRecord(f, "seed");
+	version = readRecord(f, "version");
+	seedScheme = readRecord(f, "seedScheme");
+
+	TNamed *named = dynamic_cast<TNamed*>(f->Get("eventOffsets"));
+	if(named){ // Decode "run:offset run:offset ..."
+		std::vector<std::string> pairs;
+		split_str(named->GetTitle(), pairs, ' ');
+		for(std::vector<std::string>::iterator iter = pairs.begin(); iter != pairs.end(); iter++){
+			size_t index = iter->find(':');
+			if(index == std::string::npos) continue;
+			offsets[(short)strtol(iter->substr(0, index).c_str(), NULL, 10)] = strtol(iter->substr(index+1).c_str(), NULL, 10);
+		}
+		hasOffsets = true;
+	}
+
+	// Read the event ID of every entry
+	TTree *tree = dynamic_cast<TTree*>(f->Get(treename.c_str()));
+	if(!tree){
+		Display::ErrorPrint("Failed to load TTree \""+treename+"\" from input file \""+filename+"\"!", PROGRAM_NAME);
+		f->Close();
+		delete f;
+		return false;
+	}
+
+	nDetEventStructure *evt = NULL;
+	if(tree->SetBranchAddress("event", &evt) < 0){
+		Display::ErrorPrint("Input file \""+filename+"\" has no \"event\" branch!", PROGRAM_NAME);
+		f->Close();
+		delete f;
+		return false;
+	}
+	tree->SetBranchStatus("*", 0);
+	tree->SetBranchStatus("event", 1);
+
+	for(long long i = 0; i < tree->GetEntries(); i++){
+		tree->GetEntry(i);
+		events[evt->runNb].push_back(std::make_pair(evt->eventID, i));
+	}
+
+	tree->ResetBranchAddresses();
+	delete evt;
+
+	f->Close();
+	delete f;
+
+	return (good = true);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parallel helpers
+///////////////////////////////////////////////////////////////////////////////
+
+/** Scan all input files using several threads
+  */
+void scanFiles(std::vector<shardFile> &files, const std::string &treename, const unsigned int &numThreads){
+	std::atomic<size_t> nextFile(0);
+	std::vector<std::thread> threads;
+	for(unsigned int i = 0; i < numThreads; i++){
+		threads.push_back(std::thread([&](){
+			size_t index;
+			while((index = nextFile++) < files.size())
+				files[index].scan(treename);
+		}));
+	}
+	for(std::vector<std::thread>::iterator iter = threads.begin(); iter != threads.end(); iter++)
+		iter->join();
+}
+
+/** Copy a contiguous range of event segments into a temporary output file, rewriting the event IDs
+  * @return True if all events were copied successfully and return false otherwise
+  */
+bool writePart(const std::vector<shardFile> &files, const std::vector<eventSegment> &segments, const size_t &start, const size_t &stop, const std::string &treename, const std::string &fname){
+	TFile *ofile = new TFile(fname.c_str(), "RECREATE");
+	if(!ofile->IsOpen()){
+		Display::ErrorPrint("Failed to open temporary output file \""+fname+"\"!", PROGRAM_NAME);
+		delete ofile;
+		return false;
+	}
+
+	TTree *otree = NULL;
+
+	TFile *ifile = NULL;
+	TTree *itree = NULL;
+	nDetEventStructure *evt = NULL;
+	size_t currentFile = files.size();
+
+	bool retval = true;
+	for(size_t i = start; i < stop; i++){
+		const eventSegment &segment = segments.at(i);
+		if(segment.file != currentFile){ // Open the next input file
+			if(ifile){
+				ifile->Close();
+				delete ifile;
+				delete evt;
+				evt = NULL;
+			}
+			currentFile = segment.file;
+			ifile = TFile::Open(files[currentFile].filename.c_str(), "READ");
+			itree = (ifile ? dynamic_cast<TTree*>(ifile->Get(treename.c_str())) : NULL);
+			if(!itree){
+				Display::ErrorPrint("Failed to reload input file \""+files[currentFile].filename+"\"!", PROGRAM_NAME);
+				retval = false;
+				break;
+			}
+			itree->SetBranchAddress("event", &evt);
+			if(!otree){ // Create the output tree with the same structure as the input
+				ofile->cd();
+				otree = itree->CloneTree(0);
+			}
+			else{ // Connect the output tree to the buffers of the new input tree
+				itree->AddClone(otree);
+				itree->CopyAddresses(otree);
+			}
+		}
+		for(std::vector<std::pair<long, long long> >::const_iterator iter = segment.entries.begin(); iter != segment.entries.end(); iter++){
+			itree->GetEntry(iter->second);
+			evt->eventID = (int)iter->first;
+			otree->Fill();
+		}
+	}
+
+	if(otree){
+		ofile->cd();
+		otree->Write();
+	}
+	if(ifile){ // Closing the input also disconnects the output tree
+		ifile->Close();
+		delete ifile;
+		delete evt;
+	}
+	ofile->Close();
+	delete ofile;
+
+	return retval;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+///////////////////////////////////////////////////////////////////////////////
+
+/** Join all unique non-empty strings using a delimiter, preserving the order in which they first appear
+  */
+std::string joinUnique(const std::vector<std::string> &strings, const std::string &delimiter){
+	std::string retval;
+	std::set<std::string> found;
+	for(std::vector<std::string>::const_iterator iter = strings.begin(); iter != strings.end(); iter++){
+		if(iter->empty() || !found.insert(*iter).second) continue;
+		if(!retval.empty())
+			retval += delimiter;
+		retval += (*iter);
+	}
+	return retval;
+}
+
+int main(int argc, char *argv[]){
+	optionHandler handler;
+	handler.add(optionExt("output", required_argument, NULL, 'o', "<filename>", "Specify the name of the output file (default=\"merged.root\")."));
+	handler.add(optionExt("tree", required_argument, NULL, 't', "<treename>", "Set the input and output TTree name (default=\"data\")."));
+	handler.add(optionExt("threads", required_argument, NULL, 'n', "<threads>", "Set the number of threads to use (default uses all threads)."));
+	handler.add(optionExt("list", required_argument, NULL, 'l', "<filename>", "Read input filenames from a file (one per line)."));
+	handler.add(optionExt("ignore", required_argument, NULL, 'I', "<cmd1,cmd2,...>", "Ignore additional setup commands when comparing input files."));
+	handler.add(optionExt("force", no_argument, NULL, 'f', "", "Merge files even if their setup or version records do not agree."));
+
+	// Handle user input.
+	if(!handler.setup(argc, argv))
+		return 1;
+
+	std::string outputFilename = "merged.root";
+	if(handler.getOption(0)->active) // Set output filename
+		outputFilename = handler.getOption(0)->argument;
+
+	std::string treename = "data";
+	if(handler.getOption(1)->active) // Set the TTree name
+		treename = handler.getOption(1)->argument;
+
+	unsigned int numThreads = std::max(1U, std::thread::hardware_concurrency());
+	if(handler.getOption(2)->active){ // Set the number of threads
+		long userInput = strtol(handler.getOption(2)->argument.c_str(), NULL, 10);
+		if(userInput > 0)
+			numThreads = (unsigned int)userInput;
+	}
+
+	std::vector<shardFile> files;
+	if(handler.getOption(3)->active){ // Read input filenames from a file
+		std::ifstream listFile(handler.getOption(3)->argument.c_str());
+		if(!listFile.good()){
+			Display::ErrorPrint("Failed to open input list \""+handler.getOption(3)->argument+"\"!", PROGRAM_NAME);
+			return 1;
+		}
+		std::string line;
+		while(std::getline(listFile, line)){
+			if(line.empty() || line[0] == '#') continue;
+			files.push_back(shardFile(line));
+		}
+	}
+	for(int i = optind; i < argc; i++) // Remaining arguments are input filenames
+		files.push_back(shardFile(argv[i]));
+
+	std::set<std::string> ignored(defaultIgnored, defaultIgnored+numDefaultIgnored);
+	if(handler.getOption(4)->active){ // Ignore additional setup commands
+		std::vector<std::string> names;
+		split_str(handler.getOption(4)->argument, names, ',');
+		ignored.insert(names.begin(), names.end());
+	}
+
+	bool forceMerge = handler.getOption(5)->active;
+
+	if(files.empty()){
+		Display::ErrorPrint("No input files specified!", PROGRAM_NAME);
+		return 1;
+	}
+	numThreads = std::min(numThreads, (unsigned int)files.size());
+
+	ROOT::EnableThreadSafety();
+
+	// Read the setup, provenance records and event IDs of all input files
+	std::cout << PROGRAM_NAME << ": Scanning " << files.size() << " input files using " << numThreads << " threads.\n";
+	scanFiles(files, treename, numThreads);
+	for(std::vector<shardFile>::iterator iter = files.begin(); iter != files.end(); iter++){
+		if(!iter->good){
+			Display::ErrorPrint("Failed to scan all input files!", PROGRAM_NAME);
+			return 1;
+		}
+	}
+
+	// Check that the setup of all files agrees with the first file
+	const shardFile &reference = files.front();
+	size_t numMismatched = 0;
+	std::vector<std::string> referenceCommands = getSetupCommands(reference, ignored);
+	for(std::vector<shardFile>::iterator iter = files.begin()+1; iter != files.end(); iter++){
+		// Compare the full ordered list of commands, so that repeated commands (e.g. one per detector) are all checked
+		std::vector<std::string> commands = getSetupCommands(*iter, ignored);
+		bool mismatch = false;
+		for(size_t i = 0; i < std::max(commands.size(), referenceCommands.size()); i++){
+			std::string lhsValue = (i < referenceCommands.size() ? referenceCommands[i] : "<missing>");
+			std::string rhsValue = (i < commands.size() ? commands[i] : "<missing>");
+			if(lhsValue != rhsValue){
+				Display::WarningPrint("Setup of \""+iter->filename+"\" differs from \""+reference.filename+"\": \""+rhsValue+"\" != \""+lhsValue+"\"", PROGRAM_NAME);
+				mismatch = true;
+				break; // All following commands are shifted
+			}
+		}
+		if(!mismatch && iter->version != reference.version){
+			Display::WarningPrint("Version of \""+iter->filename+"\" ("+iter->version+") differs from \""+reference.filename+"\" ("+reference.version+")", PROGRAM_NAME);
+			mismatch = true;
+		}
+		if(mismatch)
+			numMismatched++;
+	}
+	if(numMismatched > 0){
+		std::stringstream stream;
+		stream << numMismatched << " input files do not match the configuration of \"" << reference.filename << "\"";
+		if(!forceMerge){
+			Display::ErrorPrint(stream.str()+"! Use --force to merge anyway.", PROGRAM_NAME);
+			return 1;
+		}
+		Display::WarningPrint(stream.str()+".", PROGRAM_NAME);
+	}
+
+	// Build the list of event segments in the global event ID space
+	std::vector<eventSegment> segments;
+	long nextOffset = 0; // Used for files without global event ID offsets
+	long long totalEntries = 0;
+	for(size_t i = 0; i < files.size(); i++){
+		shardFile &file = files.at(i);
+		if(!file.hasOffsets)
+			Display::WarningPrint("Input file \""+file.filename+"\" has no global event offsets. Events will be numbered in input order.", PROGRAM_NAME);
+		for(std::map<short, std::vector<std::pair<int, long long> > >::iterator run = file.events.begin(); run != file.events.end(); run++){
+			eventSegment segment(i, run->first);
+			std::map<short, long>::iterator offset = file.offsets.find(run->first);
+			if(offset != file.offsets.end())
+				segment.offset = offset->second;
+			else{
+				if(file.hasOffsets)
+					Display::WarningPrint("Input file \""+file.filename+"\" has no global event offset for one of its runs.", PROGRAM_NAME);
+				segment.offset = nextOffset;
+			}
+			int maxEventID = -1;
+			for(std::vector<std::pair<int, long long> >::iterator evt = run->second.begin(); evt != run->second.end(); evt++){
+				segment.entries.push_back(std::make_pair(segment.offset + evt->first, evt->second));
+				maxEventID = std::max(maxEventID, evt->first);
+			}
+			std::sort(segment.entries.begin(), segment.entries.end());
+			if(offset == file.offsets.end())
+				nextOffset += maxEventID+1;
+			totalEntries += segment.entries.size();
+			segments.push_back(segment);
+			run->second.clear();
+		}
+	}
+	std::sort(segments.begin(), segments.end());
+
+	// Check for overlapping event IDs and for IDs which do not fit into the output structure
+	for(size_t i = 1; i < segments.size(); i++){
+		if(segments[i].first() <= segments[i-1].last()){
+			std::stringstream stream;
+			stream << "Global event IDs of \"" << files[segments[i].file].filename << "\" (run " << segments[i].runNb << ") overlap with \"" << files[segments[i-1].file].filename << "\" (run " << segments[i-1].runNb << ")";
+			if(!forceMerge){
+				Display::ErrorPrint(stream.str()+"! Use --force to merge anyway.", PROGRAM_NAME);
+				return 1;
+			}
+			Display::WarningPrint(stream.str()+".", PROGRAM_NAME);
+		}
+	}
+	if(!segments.empty() && segments.back().last() > INT_MAX){
+		Display::ErrorPrint("Global event IDs exceed the range of the output event ID!", PROGRAM_NAME);
+		return 1;
+	}
+
+	// Split the segments into contiguous groups of roughly equal size
+	std::vector<size_t> groupStart(1, 0);
+	long long groupEntries = 0;
+	for(size_t i = 0; i < segments.size(); i++){
+		groupEntries += segments[i].entries.size();
+		if(groupEntries*numThreads >= totalEntries*(long long)groupStart.size() && i+1 < segments.size() && groupStart.size() < numThreads){
+			groupStart.push_back(i+1);
+		}
+	}
+	groupStart.push_back(segments.size());
+
+	// Copy all events into temporary files in parallel
+	const size_t numParts = groupStart.size()-1;
+	std::cout << PROGRAM_NAME << ": Merging " << totalEntries << " events from " << segments.size() << " runs using " << numParts << " threads.\n";
+	std::vector<std::string> partFilenames;
+	for(size_t i = 0; i < numParts; i++){
+		std::stringstream stream;
+		stream << outputFilename << ".part" << i;
+		partFilenames.push_back(stream.str());
+	}
+	std::vector<char> partStatus(numParts, 0);
+	std::vector<std::thread> threads;
+	for(size_t i = 0; i < numParts; i++){
+		threads.push_back(std::thread([&, i](){
+			partStatus[i] = writePart(files, segments, groupStart[i], groupStart[i+1], treename, partFilenames[i]);
+		}));
+	}
+	for(std::vector<std::thread>::iterator iter = threads.begin(); iter != threads.end(); iter++)
+		iter->join();
+
+	bool retval = (std::find(partStatus.begin(), partStatus.end(), 0) == partStatus.end());
+
+	if(retval){ // Write the output file
+		TFile *ofile = new TFile(outputFilename.c_str(), "RECREATE");
+		if(!ofile->IsOpen()){
+			Display::ErrorPrint("Failed to open output file \""+outputFilename+"\"!", PROGRAM_NAME);
+			retval = false;
+		}
+		else{
+			// Concatenate all temporary files (already in global event ID order)
+			TChain chain(treename.c_str());
+			for(std::vector<std::string>::iterator iter = partFilenames.begin(); iter != partFilenames.end(); iter++)
+				chain.Add(iter->c_str());
+			chain.Merge(ofile, 0, "fast keep");
+
+			// Copy the setup commands of the first file
+			TDirectory *dir = ofile->mkdir("setup");
+			dir->cd();
+			for(std::vector<std::pair<std::string, std::string> >::const_iterator cmd = reference.setup.begin(); cmd != reference.setup.end(); cmd++){
+				TNamed named(cmd->first.c_str(), cmd->second.c_str());
+				named.Write();
+			}
+
+			// Combine the provenance records of all files
+			std::vector<std::string> seeds, versions, schemes;
+			std::set<short> runs;
+			for(std::vector<shardFile>::iterator iter = files.begin(); iter != files.end(); iter++){
+				seeds.push_back(iter->seed);
+				versions.push_back(iter->version);
+				schemes.push_back(iter->seedScheme);
+			}
+			for(std::vector<eventSegment>::iterator iter = segments.begin(); iter != segments.end(); iter++)
+				runs.insert(iter->runNb);
+
+			std::stringstream offsets; // Event IDs are now global, so all offsets are zero
+			for(std::set<short>::iterator iter = runs.begin(); iter != runs.end(); iter++)
+				offsets << (iter != runs.begin() ? " " : "") << *iter << ":0";
+
+			std::stringstream numShards;
+			numShards << files.size();
+
+			ofile->cd();
+			TNamed("seed", joinUnique(seeds, " ").c_str()).Write();
+			TNamed("version", joinUnique(versions, " ").c_str()).Write();
+			TNamed("seedScheme", joinUnique(schemes, "; ").c_str()).Write();
+			TNamed("eventOffsets", offsets.str().c_str()).Write();
+			TNamed("mergedFiles", numShards.str().c_str()).Write();
+
+			ofile->Close();
+			std::cout << PROGRAM_NAME << ": Wrote " << totalEntries << " events to \"" << outputFilename << "\".\n";
+		}
+		delete ofile;
+	}
+	else
+		Display::ErrorPrint("Failed to merge all input files!", PROGRAM_NAME);
+
+	// Remove the temporary files
+	for(std::vector<std::string>::iterator iter = partFilenames.begin(); iter != partFilenames.end(); iter++)
+		remove(iter->c_str());
+
+	return (retval ? 0 : 1);
+}